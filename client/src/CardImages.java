@@ -0,0 +1,77 @@
+import javax.imageio.ImageIO;
+import javax.swing.ImageIcon;
+import java.awt.*;
+import java.awt.image.BufferedImage;
+import java.io.File;
+import java.io.IOException;
+import java.util.HashMap;
+import java.util.Map;
+
+// Every card face and the back are decoded once and kept scaled to the size
+// the board draws them at, so a move never reads a PNG or rescales on the EDT.
+// The scaled set is only rebuilt when a different size is asked for.
+public final class CardImages {
+    private static final String[] SUITS = {"acorn", "ball", "green", "heart"};
+    private static final String[] VALUES = {"7", "8", "9", "10", "jack", "queen", "king", "ace"};
+    public static final String BACK = "back";
+
+    private static final Map<String, BufferedImage> originals = new HashMap<>();
+    private static final Map<String, ImageIcon> scaled = new HashMap<>();
+    private static int scaledWidth = -1;
+    private static int scaledHeight = -1;
+
+    private CardImages() {
+    }
+
+    // Decodes all 33 images and scales them to width x height
+    public static synchronized void load(int width, int height) {
+        if (originals.isEmpty()) {
+            for (String suit : SUITS) {
+                for (String value : VALUES) {
+                    decode(suit + "_" + value);
+                }
+            }
+            decode(BACK);
+        }
+        rescale(width, height);
+    }
+
+    // Returns the shared icon for a card name such as "heart_7", or null if there is no such image
+    public static synchronized ImageIcon get(String card, int width, int height) {
+        if (width != scaledWidth || height != scaledHeight) {
+            rescale(width, height);
+        }
+        return card == null ? null : scaled.get(card);
+    }
+
+    private static void decode(String card) {
+        try {
+            originals.put(card, ImageIO.read(new File("img/" + card + ".png")));
+        } catch (IOException e) {
+            e.printStackTrace();
+        }
+    }
+
+    private static void rescale(int width, int height) {
+        scaled.clear();
+        for (Map.Entry<String, BufferedImage> entry : originals.entrySet()) {
+            if (entry.getValue() != null) {
+                scaled.put(entry.getKey(), new ImageIcon(scale(entry.getValue(), width, height)));
+            }
+        }
+        scaledWidth = width;
+        scaledHeight = height;
+    }
+
+    // Drawn once into a plain ARGB image, which Swing paints without converting again
+    private static BufferedImage scale(BufferedImage source, int width, int height) {
+        BufferedImage target = new BufferedImage(width, height, BufferedImage.TYPE_INT_ARGB);
+        Graphics2D g = target.createGraphics();
+        g.setRenderingHint(RenderingHints.KEY_INTERPOLATION, RenderingHints.VALUE_INTERPOLATION_BICUBIC);
+        g.setRenderingHint(RenderingHints.KEY_RENDERING, RenderingHints.VALUE_RENDER_QUALITY);
+        g.setRenderingHint(RenderingHints.KEY_ANTIALIASING, RenderingHints.VALUE_ANTIALIAS_ON);
+        g.drawImage(source, 0, 0, width, height, null);
+        g.dispose();
+        return target;
+    }
+}
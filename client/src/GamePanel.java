@@ -1,14 +1,13 @@
 import javax.swing.*;
 import java.awt.*;
-import java.io.File;
-import javax.imageio.ImageIO;
-import java.awt.image.BufferedImage;
-import java.io.IOException;
 import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.List;
 
 public class GamePanel extends BasePanel {
+    private static final int CARD_WIDTH = 100;
+    private static final int CARD_HEIGHT = 150;
+
     // UI components
     private CardLayout cardLayout;
     private JPanel mainPanel;
@@ -45,6 +44,7 @@ public class GamePanel extends BasePanel {
         setBackground(new Color(50, 50, 50));
         playerHand = new ArrayList<>();
         opponentHand = new ArrayList<>();
+        CardImages.load(CARD_WIDTH, CARD_HEIGHT);
 
         initializeOpponentPanel();
         initializePlayArea();
@@ -89,14 +89,14 @@ public class GamePanel extends BasePanel {
         playAreaPanel.add(suitSelectionPanel);
     
         // Draw pile
-        drawPileLabel = createCardLabel("img/back.png", 100, 150);
-        drawPileLabel.setBounds(150, 20, 100, 150);
+        drawPileLabel = createCardLabel(CardImages.BACK, CARD_WIDTH, CARD_HEIGHT);
+        drawPileLabel.setBounds(150, 20, CARD_WIDTH, CARD_HEIGHT);
         playAreaPanel.add(drawPileLabel);
         addCardListener(drawPileLabel, "drawPile");
     
         // Discard pile
         discardPileLabel = new JLabel();
-        discardPileLabel.setBounds(350, 20, 100, 150);
+        discardPileLabel.setBounds(350, 20, CARD_WIDTH, CARD_HEIGHT);
         playAreaPanel.add(discardPileLabel);
     
         // Skip confirmation button
@@ -250,7 +250,7 @@ public class GamePanel extends BasePanel {
     private void handleOpponentCardUpdate(String message) {
         String playedCard = message.split("\\|")[1];
         discardPileLabel.setBorder(BorderFactory.createEmptyBorder()); // Clear border
-        discardPileLabel.setIcon(new ImageIcon(loadCardImage("img/" + playedCard + ".png")));
+        discardPileLabel.setIcon(CardImages.get(playedCard, CARD_WIDTH, CARD_HEIGHT));
         discardPileLabel.repaint();
         opponentHand.remove(0);
         updateOpponentHand();
@@ -296,7 +296,7 @@ public class GamePanel extends BasePanel {
         discardPileLabel.repaint();
 
         // Update the discard pile UI
-        discardPileLabel.setIcon(new ImageIcon(loadCardImage("img/" + cardName + ".png")));
+        discardPileLabel.setIcon(CardImages.get(cardName, CARD_WIDTH, CARD_HEIGHT));
         selectedCardLabel = null;
         topDiscardedCardName = cardName;
     
@@ -322,14 +322,13 @@ public class GamePanel extends BasePanel {
 
     private void updateHand(JLayeredPane handPanel, List<String> hand, boolean isPlayer) {
         handPanel.removeAll();
-        int cardWidth = 100;
         int cardSpacing = 30;
         int startX = 0;
 
         for (int i = 0; i < hand.size(); i++) {
-            String card = isPlayer ? "img/" + hand.get(i) + ".png" : "img/back.png";
-            JLabel cardLabel = createCardLabel(card, cardWidth, 150);
-            cardLabel.setBounds(startX + i * cardSpacing, 50, cardWidth, 150);
+            String card = isPlayer ? hand.get(i) : CardImages.BACK;
+            JLabel cardLabel = createCardLabel(card, CARD_WIDTH, CARD_HEIGHT);
+            cardLabel.setBounds(startX + i * cardSpacing, 50, CARD_WIDTH, CARD_HEIGHT);
             if (isPlayer) addCardListener(cardLabel, hand.get(i));
             handPanel.add(cardLabel, i);
         }
@@ -367,26 +366,9 @@ public class GamePanel extends BasePanel {
     // Utility Methods
     // ===========================
 
-    private JLabel createCardLabel(String imagePath, int width, int height) {
-        JLabel cardLabel = new JLabel();
-        try {
-            BufferedImage cardImage = ImageIO.read(new File(imagePath));
-            ImageIcon cardIcon = new ImageIcon(cardImage.getScaledInstance(width, height, Image.SCALE_SMOOTH));
-            cardLabel.setIcon(cardIcon);
-        } catch (IOException e) {
-            e.printStackTrace();
-        }
-        return cardLabel;
-    }
-
-    private Image loadCardImage(String imagePath) {
-        try {
-            BufferedImage cardImage = ImageIO.read(new File(imagePath));
-            return cardImage.getScaledInstance(100, 150, Image.SCALE_SMOOTH);
-        } catch (IOException e) {
-            e.printStackTrace();
-        }
-        return null;
+    // The icon is shared with every other label showing the same card
+    private JLabel createCardLabel(String card, int width, int height) {
+        return new JLabel(CardImages.get(card, width, height));
     }
 
     private void addCardListener(JLabel cardLabel, String cardName) {
@@ -494,7 +476,7 @@ public class GamePanel extends BasePanel {
         opponentHand.addAll(parseOpponentHand(gameState));
         playerTurn = parsePlayerTurn(gameState);
         topDiscardedCardName = parseTopDiscard(gameState);
-        discardPileLabel.setIcon(new ImageIcon(loadCardImage("img/" + topDiscardedCardName + ".png")));
+        discardPileLabel.setIcon(CardImages.get(topDiscardedCardName, CARD_WIDTH, CARD_HEIGHT));
     
         // Check for SKIP_PENDING or FORCE_DRAW_PENDING flags
         if (gameState.contains("SKIP_PENDING")) {
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+#include "admin.h"
+#include "game.h"
+#include "network.h"
+#include "bot.h"
+#include "spectator.h"
+#include "admission.h"
+#include "recorder.h"
+#include "profile.h"
+#include "output.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Local admin socket served from the event loop. Commands are one line of
+// text; every answer ends with "END" or "ERR <reason>". Long listings are
+// produced a slice at a time as the connection drains, so the loop never
+// spends more than ADMIN_SCAN_BATCH slots on a query before serving players.
+
+typedef enum {
+    LIST_NONE,
+    LIST_SESSIONS,
+    LIST_PLAYERS
+} ListKind;
+
+typedef struct {
+    int fd;               // -1 when free
+    char in[ADMIN_LINE];
+    int inLen;
+    char out[ADMIN_OUT];
+    int outLen;
+    int outPos;
+    ListKind list;        // Listing in progress
+    int cursor;           // Next slot the listing looks at
+} AdminClient;
+
+typedef struct {
+    unsigned long iterations;
+    long long workUs;
+    long maxUs;
+    int seconds;
+} LoopLoad;
+
+static AdminClient admins[ADMIN_MAX_CLIENTS];
+static int admin_fd = -1;
+static LoopLoad current_load;
+static LoopLoad last_load;
+static time_t window_start = 0;
+
+static const char *state_names[] = {"idle", "waiting", "playing", "disconnected", "gameover"};
+
+int admin_listen(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Admin socket path too long: %s\n", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    admin_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (admin_fd < 0) {
+        perror("Admin socket creation failed");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(admin_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(admin_fd, 4) < 0) {
+        perror("Admin socket bind failed");
+        close(admin_fd);
+        admin_fd = -1;
+        return -1;
+    }
+
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        admins[i].fd = -1;
+    }
+    FD_SET(admin_fd, &all_fds);
+    if (admin_fd > max_fd) max_fd = admin_fd;
+    window_start = time(NULL);
+    printf("Admin socket listening on %s.\n", path);
+    return 0;
+}
+
+void admin_record_loop(long work_us) {
+    current_load.iterations++;
+    current_load.workUs += work_us;
+    if (work_us > current_load.maxUs) current_load.maxUs = work_us;
+
+    time_t now = time(NULL);
+    if (now - window_start >= ADMIN_LOAD_WINDOW) {
+        last_load = current_load;
+        last_load.seconds = now - window_start;
+        memset(&current_load, 0, sizeof(current_load));
+        window_start = now;
+    }
+}
+
+static void emit(AdminClient *admin, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(admin->out + admin->outLen, ADMIN_OUT - admin->outLen, format, args);
+    va_end(args);
+
+    if (n < 0 || n >= ADMIN_OUT - admin->outLen) {
+        // Only a dump can get here; cut it rather than overflow
+        admin->outLen = ADMIN_OUT;
+        return;
+    }
+    admin->outLen += n;
+}
+
+static int has_room(const AdminClient *admin) {
+    return ADMIN_OUT - admin->outLen > 4 * ADMIN_LINE;
+}
+
+static GameSession *session_at(const char *arg) {
+    char *end;
+    long slot = strtol(arg, &end, 10);
+    if (!*arg || *end || slot < 0 || slot >= MAX_SESSIONS) return NULL;
+
+    GameSession *session = &sessions[slot];
+    return (session->players[0] || session->players[1]) ? session : NULL;
+}
+
+static Player *player_named(const char *username) {
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if ((players[i].sockfd != -1 || players[i].state != STATE_IDLE) &&
+            strcmp(players[i].username, username) == 0) {
+            return &players[i];
+        }
+    }
+    return NULL;
+}
+
+static void emit_session_line(AdminClient *admin, int slot) {
+    GameSession *session = &sessions[slot];
+    Player *p0 = session->players[0];
+    Player *p1 = session->players[1];
+    Player *turn = (session->currentTurn == 0 || session->currentTurn == 1) ? session->players[session->currentTurn] : NULL;
+
+    emit(admin, "%d %s %s turn=%s hands=%d,%d draw=%d discard=%d active=%s_%s%s%s watchers=%d\n", slot,
+         p0 ? p0->username : "-", p1 ? p1->username : "-", turn ? turn->username : "-",
+         p0 ? p0->handSize : 0, p1 ? p1->handSize : 0,
+         session->drawDeck.topCardIndex + 1, session->discardDeck.topCardIndex + 1,
+         session->activeSuit, session->activeValue,
+         session->skipPending ? " skip" : "",
+         session->force_draw_count > 0 ? " force_draw" : "",
+         session->spectatorCount);
+}
+
+static void emit_player_line(AdminClient *admin, int slot) {
+    Player *player = &players[slot];
+    emit(admin, "%d %s fd=%d state=%s hand=%d missed=%d rating=%d rtt_ms=%.2f jitter_ms=%.2f%s\n", slot,
+         player->username[0] ? player->username : "-", player->sockfd,
+         player->state <= STATE_GAMEOVER ? state_names[player->state] : "?",
+         player->handSize, player->missedHeartbeats, player->rating, player->rttUs / 1000.0,
+         player->rttVarUs / 1000.0, is_bot_player(player) ? " bot" : "");
+}
+
+static void continue_list(AdminClient *admin) {
+    int limit = admin->list == LIST_SESSIONS ? MAX_SESSIONS : MAX_PLAYERS;
+    int stop = admin->cursor + ADMIN_SCAN_BATCH;
+
+    while (admin->cursor < limit && admin->cursor < stop && has_room(admin)) {
+        int slot = admin->cursor++;
+        if (admin->list == LIST_SESSIONS) {
+            if (sessions[slot].players[0] || sessions[slot].players[1]) emit_session_line(admin, slot);
+        } else if (players[slot].sockfd != -1 || players[slot].state != STATE_IDLE) {
+            emit_player_line(admin, slot);
+        }
+    }
+
+    if (admin->cursor >= limit && has_room(admin)) {
+        emit(admin, "END\n");
+        admin->list = LIST_NONE;
+    }
+}
+
+static void dump_session(AdminClient *admin, GameSession *session) {
+    emit_session_line(admin, (int)(session - sessions));
+    for (int i = 0; i < 2; i++) {
+        Player *player = session->players[i];
+        if (!player) continue;
+
+        emit(admin, "player%d %s fd=%d state=%s missed=%d pending_heartbeat=%d hand=", i, player->username,
+             player->sockfd, player->state <= STATE_GAMEOVER ? state_names[player->state] : "?",
+             player->missedHeartbeats, player->pendingHeartbeat);
+        for (int j = 0; j < player->handSize; j++) {
+            emit(admin, "%s%s", j ? "," : "", player->hand[j]);
+        }
+        emit(admin, "\n");
+    }
+    emit(admin, "active %s_%s force_draw_count=%d\n", session->activeSuit, session->activeValue,
+         session->force_draw_count);
+    emit(admin, "draw");
+    for (int i = session->drawDeck.topCardIndex; i >= 0; i--) {
+        emit(admin, " %s", session->drawDeck.deck[i]);
+    }
+    emit(admin, "\ndiscard");
+    for (int i = session->discardDeck.topCardIndex; i >= 0; i--) {
+        emit(admin, " %s", session->discardDeck.deck[i]);
+    }
+    emit(admin, "\nEND\n");
+}
+
+static void show_load(AdminClient *admin) {
+    int connected = 0, waiting = 0, playing = 0;
+    int measured = 0, max_rtt = 0;
+    long long rtt_sum = 0, jitter_sum = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (players[i].sockfd != -1) connected++;
+        if (players[i].state == STATE_WAITING) waiting++;
+        if (players[i].state == STATE_PLAYING) playing++;
+        if (players[i].sockfd != -1 && players[i].rttUs) {
+            measured++;
+            rtt_sum += players[i].rttUs;
+            jitter_sum += players[i].rttVarUs;
+            if (players[i].rttUs > max_rtt) max_rtt = players[i].rttUs;
+        }
+    }
+
+    // Last complete window, or the running one before the first window closes
+    LoopLoad load = last_load;
+    if (!load.iterations) {
+        load = current_load;
+        load.seconds = time(NULL) - window_start;
+    }
+    if (load.seconds < 1) load.seconds = 1;
+    emit(admin, "loop iterations=%lu avg_us=%.1f max_us=%ld busy=%.1f%% window=%ds\n", load.iterations,
+         load.iterations ? (double)load.workUs / load.iterations : 0.0, load.maxUs,
+         load.workUs / (load.seconds * 10000.0), load.seconds);
+    emit(admin, "players connected=%d waiting=%d playing=%d sessions=%d spectators=%d\n",
+         connected, waiting, playing, session_count, spectator_active());
+    emit(admin, "rtt measured=%d avg_ms=%.2f max_ms=%.2f jitter_avg_ms=%.2f\n", measured,
+         measured ? rtt_sum / 1000.0 / measured : 0.0, max_rtt / 1000.0,
+         measured ? jitter_sum / 1000.0 / measured : 0.0);
+    emit(admin, "admission accepted=%lu rejected=%lu throttled=%lu overloaded=%d\n", admission_stats.accepted,
+         admission_stats.rejectedFull + admission_stats.rejectedIpLimit + admission_stats.rejectedOverload,
+         admission_stats.throttledCommands, admission_overloaded());
+    emit(admin, "scheduler waiting=%d shed=%lu", scheduler_waiting(), scheduler_stats.shed);
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        emit(admin, " %s=%lu/%lu", command_class_names[i], scheduler_stats.run[i], scheduler_stats.exhausted[i]);
+    }
+    emit(admin, "\n");
+    emit(admin, "output messages=%lu writes=%lu bound_flushes=%lu\n", output_stats.messages, output_stats.writes,
+         output_stats.boundFlushes);
+    if (profile_enabled()) {
+        ProfileStats store;
+        profile_get_stats(&store);
+        emit(admin, "store queued=%lu written=%lu batches=%lu dropped=%lu\n", store.queued, store.written,
+             store.batches, store.dropped);
+    }
+    if (bots_enabled()) {
+        emit(admin, "bots queued=%d\n", bot_jobs_queued());
+        BotWorkerLoad worker;
+        for (int i = 0; bot_worker_load(i, &worker) == 0; i++) {
+            emit(admin, "worker %d decisions=%lu busy_ms=%.1f\n", i, worker.decisions, worker.busyMs);
+        }
+    }
+    emit(admin, "END\n");
+}
+
+// What one unit of each kind holds in the server's own arrays. Kernel socket
+// buffers are not included; RSS is what the process really touched.
+static void show_memory(AdminClient *admin) {
+    int connected = 0, waiting = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (players[i].sockfd != -1) connected++;
+        if (players[i].state == STATE_WAITING) waiting++;
+    }
+
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+
+    size_t connection = sizeof(Player) + sizeof(PendingOutput);
+    size_t session = sizeof(GameSession) + sizeof(FlightRecorder);
+    size_t reserved = MAX_PLAYERS * sizeof(Player) + FD_SETSIZE * sizeof(PendingOutput) +
+                      MAX_SESSIONS * session;
+    emit(admin, "rss_kb=%ld reserved_kb=%zu\n", resident * (sysconf(_SC_PAGESIZE) / 1024), reserved / 1024);
+    emit(admin, "connection bytes=%zu count=%d total_kb=%zu player=%zu output=%zu\n", connection, connected,
+         connected * connection / 1024, sizeof(Player), sizeof(PendingOutput));
+    emit(admin, "waiting bytes=%zu count=%d total_kb=%zu\n", connection, waiting, waiting * connection / 1024);
+    emit(admin, "partial bytes=%d count=%d pooled=%d total_kb=%d\n", BUFFER_SIZE, receive_stats.leased,
+         receive_stats.pooled, (receive_stats.leased + receive_stats.pooled) * BUFFER_SIZE / 1024);
+    emit(admin, "session bytes=%zu count=%d total_kb=%zu decks=%zu recorder=%zu\n", session, session_count,
+         session_count * session / 1024, 2 * sizeof(CardDeck), sizeof(FlightRecorder));
+    emit(admin, "END\n");
+}
+
+static void run_command(AdminClient *admin, char *line) {
+    char *command = strtok(line, " \t\r");
+    char *arg = strtok(NULL, " \t\r");
+
+    if (!command) {
+        emit(admin, "ERR empty command\n");
+    } else if (strcmp(command, "list") == 0 || strcmp(command, "players") == 0) {
+        admin->list = command[0] == 'l' ? LIST_SESSIONS : LIST_PLAYERS;
+        admin->cursor = 0;
+        continue_list(admin);
+    } else if (strcmp(command, "dump") == 0) {
+        GameSession *session = arg ? session_at(arg) : NULL;
+        if (session) dump_session(admin, session);
+        else emit(admin, "ERR no such session\n");
+    } else if (strcmp(command, "end") == 0) {
+        GameSession *session = arg ? session_at(arg) : NULL;
+        if (session) {
+            printf("Admin ended session %d.\n", (int)(session - sessions));
+            terminate_session(session);
+            emit(admin, "END\n");
+        } else {
+            emit(admin, "ERR no such session\n");
+        }
+    } else if (strcmp(command, "kick") == 0) {
+        Player *player = arg ? player_named(arg) : NULL;
+        if (player && player->sockfd != -1) {
+            printf("Admin kicked player %s.\n", player->username);
+            disconnect_player(player);
+            emit(admin, "END\n");
+        } else {
+            emit(admin, "ERR no such player\n");
+        }
+    } else if (strcmp(command, "flight") == 0) {
+        // Also allowed on a slot whose game has ended, until the slot is reused
+        char *end;
+        long slot = arg ? strtol(arg, &end, 10) : -1;
+        char path[512];
+        if (!arg || *end || slot < 0 || slot >= MAX_SESSIONS) {
+            emit(admin, "ERR no such session\n");
+        } else if (recorder_dump(&sessions[slot], "admin request", path, sizeof(path)) < 0) {
+            emit(admin, "ERR cannot write the recording\n");
+        } else {
+            emit(admin, "%s\nEND\n", path);
+        }
+    } else if (strcmp(command, "load") == 0) {
+        show_load(admin);
+    } else if (strcmp(command, "memory") == 0) {
+        show_memory(admin);
+    } else {
+        emit(admin, "ERR unknown command %s\n", command);
+    }
+}
+
+static void close_admin(AdminClient *admin) {
+    FD_CLR(admin->fd, &all_fds);
+    close(admin->fd);
+    admin->fd = -1;
+}
+
+static int flush_admin(AdminClient *admin) {
+    while (admin->outPos < admin->outLen) {
+        ssize_t n = send(admin->fd, admin->out + admin->outPos, admin->outLen - admin->outPos, MSG_NOSIGNAL);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        admin->outPos += n;
+    }
+    admin->outLen = admin->outPos = 0;
+    return 0;
+}
+
+static void run_pending(AdminClient *admin) {
+    char *newline;
+    // One command at a time; the next waits until a listing has finished
+    // and the previous answer left room in the buffer
+    while (admin->list == LIST_NONE && has_room(admin) && (newline = strchr(admin->in, '\n')) != NULL) {
+        *newline = '\0';
+        run_command(admin, admin->in);
+        admin->inLen -= newline + 1 - admin->in;
+        memmove(admin->in, newline + 1, admin->inLen + 1);
+    }
+}
+
+static int read_commands(AdminClient *admin) {
+    ssize_t n = read(admin->fd, admin->in + admin->inLen, sizeof(admin->in) - admin->inLen - 1);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return -1;
+    if (n < 0) return 0;
+    admin->inLen += n;
+    admin->in[admin->inLen] = '\0';
+
+    run_pending(admin);
+    return admin->inLen >= (int)sizeof(admin->in) - 1 ? -1 : 0;
+}
+
+static void accept_admin() {
+    int fd = accept(admin_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        AdminClient *admin = &admins[i];
+        if (admin->fd != -1) continue;
+
+        memset(admin, 0, sizeof(*admin));
+        admin->fd = fd;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        FD_SET(fd, &all_fds);
+        if (fd > max_fd) max_fd = fd;
+        return;
+    }
+
+    send(fd, "ERR too many admin connections\n", 31, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
+void admin_prepare_fds(fd_set *write_fds) {
+    for (int i = 0; admin_fd >= 0 && i < ADMIN_MAX_CLIENTS; i++) {
+        if (admins[i].fd != -1 && (admins[i].outLen > admins[i].outPos || admins[i].list != LIST_NONE)) {
+            FD_SET(admins[i].fd, write_fds);
+        }
+    }
+}
+
+void admin_handle_io(fd_set *read_fds, fd_set *write_fds) {
+    if (admin_fd < 0) return;
+    if (FD_ISSET(admin_fd, read_fds)) accept_admin();
+
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        AdminClient *admin = &admins[i];
+        if (admin->fd == -1) continue;
+
+        if (FD_ISSET(admin->fd, read_fds) && read_commands(admin) < 0) {
+            close_admin(admin);
+            continue;
+        }
+        if (admin->list != LIST_NONE && FD_ISSET(admin->fd, write_fds)) {
+            continue_list(admin);
+        }
+        if (flush_admin(admin) < 0) {
+            close_admin(admin);
+            continue;
+        }
+        // Commands that arrived behind a listing run once it is done
+        if (admin->list == LIST_NONE && admin->inLen > 0) {
+            run_pending(admin);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <sys/select.h>
+
+#define ADMIN_MAX_CLIENTS 8
+#define ADMIN_LINE 256          // Longest command
+#define ADMIN_OUT 65536         // Output buffered per admin connection
+#define ADMIN_SCAN_BATCH 1024   // Slots a streaming list walks per loop iteration
+#define ADMIN_LOAD_WINDOW 10    // Seconds covered by the loop load figures
+
+int admin_listen(const char *path);
+void admin_prepare_fds(fd_set *write_fds);
+void admin_handle_io(fd_set *read_fds, fd_set *write_fds);
+void admin_record_loop(long work_us);
+
+#endif
@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "admission.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+AdmissionStats admission_stats;
+
+typedef struct {
+    uint32_t ip;
+    int count;      // 0 marks an empty bucket
+} IpEntry;
+
+static IpEntry ip_table[IP_TABLE_SIZE];
+static uint32_t fd_ip[FD_SETSIZE];
+static char fd_tracked[FD_SETSIZE];
+static long long overload_until_ms = 0;
+static long long last_report_ms = 0;
+static AdmissionStats last_reported;
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned ip_hash(uint32_t ip) {
+    return (ip * 2654435761u) & (IP_TABLE_SIZE - 1);
+}
+
+// Linear probing; returns the entry for ip or the empty bucket where it belongs
+static IpEntry *ip_lookup(uint32_t ip) {
+    unsigned i = ip_hash(ip);
+    while (ip_table[i].count != 0 && ip_table[i].ip != ip) {
+        i = (i + 1) & (IP_TABLE_SIZE - 1);
+    }
+    return &ip_table[i];
+}
+
+static void ip_remove(IpEntry *entry) {
+    // Backward shift deletion keeps probe chains intact without tombstones
+    unsigned hole = entry - ip_table;
+    unsigned i = hole;
+    entry->count = 0;
+
+    while (1) {
+        i = (i + 1) & (IP_TABLE_SIZE - 1);
+        if (ip_table[i].count == 0) return;
+
+        unsigned home = ip_hash(ip_table[i].ip);
+        if (((i - home) & (IP_TABLE_SIZE - 1)) >= ((i - hole) & (IP_TABLE_SIZE - 1))) {
+            ip_table[hole] = ip_table[i];
+            ip_table[i].count = 0;
+            hole = i;
+        }
+    }
+}
+
+AdmissionVerdict admission_accept(int sockfd, uint32_t ip, int slot_available) {
+    AdmissionVerdict verdict = ADMIT_OK;
+    IpEntry *entry = ip_lookup(ip);
+
+    if (sockfd < 0 || sockfd >= FD_SETSIZE || !slot_available) {
+        verdict = ADMIT_SERVER_FULL;
+        admission_stats.rejectedFull++;
+    } else if (admission_overloaded()) {
+        verdict = ADMIT_OVERLOAD;
+        admission_stats.rejectedOverload++;
+    } else if (ip != 0 && config()->maxPerIp > 0 && entry->count >= config()->maxPerIp) {
+        verdict = ADMIT_IP_LIMIT;
+        admission_stats.rejectedIpLimit++;
+    }
+
+    if (verdict != ADMIT_OK) return verdict;
+
+    admission_stats.accepted++;
+    // Local peers (a router on a Unix socket) share no address worth capping
+    if (ip == 0) return ADMIT_OK;
+
+    entry->ip = ip;
+    entry->count++;
+    fd_ip[sockfd] = ip;
+    fd_tracked[sockfd] = 1;
+    return ADMIT_OK;
+}
+
+void admission_release(int sockfd) {
+    if (sockfd < 0 || sockfd >= FD_SETSIZE || !fd_tracked[sockfd]) return;
+
+    IpEntry *entry = ip_lookup(fd_ip[sockfd]);
+    if (entry->count > 1) {
+        entry->count--;
+    } else if (entry->count == 1) {
+        ip_remove(entry);
+    }
+    fd_tracked[sockfd] = 0;
+}
+
+int admission_allow_command(Player *player) {
+    const Config *settings = config();
+    if (settings->rate <= 0) return 1;
+
+    long long now = now_ms();
+    if (player->lastRefillMs == 0) {
+        player->tokens = settings->burst;
+    } else {
+        player->tokens += (now - player->lastRefillMs) * settings->rate / 1000.0;
+        if (player->tokens > settings->burst) player->tokens = settings->burst;
+    }
+    player->lastRefillMs = now;
+
+    if (player->tokens >= 1.0) {
+        player->tokens -= 1.0;
+        player->throttled = 0;
+        return 1;
+    }
+
+    player->throttled++;
+    admission_stats.throttledCommands++;
+    return 0;
+}
+
+void admission_record_work(long work_us) {
+    long long now = now_ms();
+
+    // Stay in overload for a second after the last slow iteration
+    int overload_ms = config()->overloadMs;
+    if (overload_ms > 0 && work_us > overload_ms * 1000L) {
+        if (now >= overload_until_ms) {
+            admission_stats.overloadEpisodes++;
+            printf("Event loop took %ld ms. Shedding new connections.\n", work_us / 1000);
+        }
+        overload_until_ms = now + 1000;
+    }
+
+    if (now - last_report_ms >= ADMISSION_STATS_INTERVAL * 1000) {
+        last_report_ms = now;
+        if (memcmp(&last_reported, &admission_stats, sizeof(admission_stats)) != 0) {
+            admission_print_stats();
+            last_reported = admission_stats;
+        }
+    }
+}
+
+int admission_overloaded() {
+    return now_ms() < overload_until_ms;
+}
+
+void admission_print_stats() {
+    printf("Admission: accepted %lu, rejected full %lu / ip limit %lu / overload %lu, "
+           "throttled commands %lu, rate disconnects %lu, overload episodes %lu\n",
+           admission_stats.accepted, admission_stats.rejectedFull, admission_stats.rejectedIpLimit,
+           admission_stats.rejectedOverload, admission_stats.throttledCommands,
+           admission_stats.rateDisconnects, admission_stats.overloadEpisodes);
+}
+
+const char *admission_verdict_name(AdmissionVerdict verdict) {
+    switch (verdict) {
+    case ADMIT_OK: return "ok";
+    case ADMIT_SERVER_FULL: return "server full";
+    case ADMIT_IP_LIMIT: return "per-IP limit";
+    case ADMIT_OVERLOAD: return "overload";
+    }
+    return "unknown";
+}
@@ -0,0 +1,39 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "player.h"
+#include <stdint.h>
+#include <sys/select.h>
+
+#define IP_TABLE_SIZE 4096          // Power of two, well above the connection limit
+#define ADMISSION_MAX_THROTTLED 200 // Dropped commands in a row before the connection is cut
+#define ADMISSION_STATS_INTERVAL 10 // Seconds between counter reports
+
+typedef enum {
+    ADMIT_OK,
+    ADMIT_SERVER_FULL,
+    ADMIT_IP_LIMIT,
+    ADMIT_OVERLOAD
+} AdmissionVerdict;
+
+typedef struct {
+    unsigned long accepted;
+    unsigned long rejectedFull;
+    unsigned long rejectedIpLimit;
+    unsigned long rejectedOverload;
+    unsigned long throttledCommands;
+    unsigned long rateDisconnects;
+    unsigned long overloadEpisodes;
+} AdmissionStats;
+
+extern AdmissionStats admission_stats;
+
+AdmissionVerdict admission_accept(int sockfd, uint32_t ip, int slot_available);
+void admission_release(int sockfd);
+int admission_allow_command(Player *player);
+void admission_record_work(long work_us);
+int admission_overloaded();
+void admission_print_stats();
+const char *admission_verdict_name(AdmissionVerdict verdict);
+
+#endif
@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include "bot.h"
+#include "game.h"
+#include "network.h"
+#include "montecarlo.h"
+#include "config.h"
+#include "placement.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// A bot is an in-process client: the server talks to it over one end of a
+// socketpair exactly like a network player, and the bot answers on the other.
+typedef struct {
+    Player *player;       // NULL when the seat is free
+    int serverFd;         // End owned by the Player slot
+    int peerFd;           // End the bot reads from and writes to
+    unsigned generation;  // Bumped on release so stale results are dropped
+    int joined;           // Server has processed the bot's enterQ
+    int jobPending;       // A decision is being computed
+    int awaitingReply;    // Commands sent, waiting for the server to answer
+    int invalidMoves;
+    char inbox[BUFFER_SIZE];
+    int inboxLen;
+    char outbox[2 * BUFFER_SIZE];  // Commands the socketpair did not take yet
+    int outboxLen;
+} Bot;
+
+typedef struct {
+    int bot;
+    unsigned generation;
+    uint64_t seed;
+    CompactGame game;
+} BotJob;
+
+typedef struct {
+    int bot;
+    unsigned generation;
+    Move move;
+    MonteCarloStats stats;
+} BotResult;
+
+static Bot bots[MAX_BOTS];
+static BotJob job_queue[MAX_BOTS];
+static int job_head = 0;
+static int job_count = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static int result_pipe[2] = {-1, -1};
+static BotWorkerLoad *worker_load;   // One entry per worker, guarded by job_lock
+
+static void *bot_worker(void *arg) {
+    BotWorkerLoad *load = arg;
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        while (job_count == 0) {
+            pthread_cond_wait(&job_ready, &job_lock);
+        }
+        BotJob job = job_queue[job_head];
+        job_head = (job_head + 1) % MAX_BOTS;
+        job_count--;
+        pthread_mutex_unlock(&job_lock);
+
+        BotResult result = {job.bot, job.generation, {0}, {0}};
+        mc_choose_move(&job.game, job.seed, config()->botBudgetMs, BOT_MAX_ROLLOUTS, &result.move, &result.stats);
+
+        pthread_mutex_lock(&job_lock);
+        load->decisions++;
+        load->busyMs += result.stats.elapsedMs;
+        pthread_mutex_unlock(&job_lock);
+
+        // Results are smaller than PIPE_BUF so each write is atomic
+        if (write(result_pipe[1], &result, sizeof(result)) != sizeof(result)) {
+            perror("Failed to post bot result");
+        }
+    }
+    return NULL;
+}
+
+void init_bots() {
+    for (int i = 0; i < MAX_BOTS; i++) {
+        bots[i].player = NULL;
+        bots[i].serverFd = -1;
+        bots[i].peerFd = -1;
+    }
+
+    if (!bots_enabled()) return;
+
+    if (pipe(result_pipe) < 0) {
+        perror("Bot result pipe failed");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(result_pipe[0], F_SETFL, O_NONBLOCK);
+    FD_SET(result_pipe[0], &all_fds);
+    if (result_pipe[0] > max_fd) max_fd = result_pipe[0];
+
+    worker_load = calloc(config()->botWorkers, sizeof(BotWorkerLoad));
+    for (int i = 0; i < config()->botWorkers; i++) {
+        pthread_t worker;
+        pthread_create(&worker, NULL, bot_worker, &worker_load[i]);
+        if (config()->workerCpu >= 0) {
+            char name[32];
+            snprintf(name, sizeof(name), "bot worker %d", i);
+            placement_pin(worker, (config()->workerCpu + i) % sysconf(_SC_NPROCESSORS_CONF), name);
+        }
+        pthread_detach(worker);
+    }
+
+    printf("Bots enabled: join after %d s, %d ms per move, %d workers.\n",
+           config()->botTimeout, config()->botBudgetMs, config()->botWorkers);
+}
+
+int bots_enabled() {
+    return config()->botTimeout > 0;
+}
+
+int is_bot_player(const Player *player) {
+    for (int i = 0; i < MAX_BOTS; i++) {
+        if (bots[i].player == player) return 1;
+    }
+    return 0;
+}
+
+// Writes what the outbox holds; what the socketpair refuses stays for the next iteration
+static void flush_outbox(Bot *bot) {
+    if (bot->outboxLen == 0) return;
+    ssize_t written = write(bot->peerFd, bot->outbox, bot->outboxLen);
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Bot failed to send command");
+        return;
+    }
+    bot->outboxLen -= written;
+    memmove(bot->outbox, bot->outbox + written, bot->outboxLen);
+}
+
+static void bot_send(Bot *bot, const char *opcode, const char *data) {
+    // Header, username and data each fit BUFFER_SIZE
+    char message[2 * BUFFER_SIZE + 32];
+    const char *name = bot->player->username;
+    int len;
+
+    if (data) {
+        len = snprintf(message, sizeof(message), "KIVUPS%s%04d%s%04d%s\n",
+                       opcode, (int)strlen(name), name, (int)strlen(data), data);
+    } else {
+        len = snprintf(message, sizeof(message), "KIVUPS%s%04d%s\n", opcode, (int)strlen(name), name);
+    }
+    if (len < 0 || len >= (int)sizeof(message)) {
+        printf("Bot %s: command %s too long, not sent.\n", name, opcode);
+        return;
+    }
+
+    // Queued behind anything still waiting so the server sees commands in order
+    if (len > (int)sizeof(bot->outbox) - bot->outboxLen) {
+        printf("Bot %s: outbox full, command %s dropped.\n", name, opcode);
+        return;
+    }
+    memcpy(bot->outbox + bot->outboxLen, message, len);
+    bot->outboxLen += len;
+    flush_outbox(bot);
+}
+
+static void spawn_bot() {
+    int seat = -1;
+    for (int i = 0; i < MAX_BOTS; i++) {
+        if (!bots[i].player) {
+            seat = i;
+            break;
+        }
+    }
+
+    // A bot takes a seat under the same limits as a connection and its game
+    const Config *settings = config();
+    Player *slot = NULL;
+    for (int i = 0; i < settings->maxPlayers; i++) {
+        if (players[i].sockfd == -1 && players[i].state != STATE_DISCONNECTED) {
+            slot = &players[i];
+            break;
+        }
+    }
+
+    if (seat < 0 || !slot || session_count >= settings->maxSessions) {
+        printf("No free seat for a bot.\n");
+        return;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("Bot socketpair failed");
+        return;
+    }
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    Bot *bot = &bots[seat];
+    bot->player = slot;
+    bot->serverFd = fds[0];
+    bot->peerFd = fds[1];
+    bot->joined = 0;
+    bot->jobPending = 0;
+    bot->awaitingReply = 0;
+    bot->invalidMoves = 0;
+    bot->inboxLen = 0;
+    bot->outboxLen = 0;
+
+    slot->sockfd = fds[0];
+    snprintf(slot->username, BUFFER_SIZE, "BOT_%d", seat);
+
+    FD_SET(fds[0], &all_fds);
+    FD_SET(fds[1], &all_fds);
+    if (fds[0] > max_fd) max_fd = fds[0];
+    if (fds[1] > max_fd) max_fd = fds[1];
+
+    // Goes through the normal enterQ path on the next loop iteration
+    bot_send(bot, "enterQ", NULL);
+    printf("Bot %s joining the queue (slot fd: %d).\n", slot->username, fds[0]);
+}
+
+static void release_bot(Bot *bot) {
+    Player *player = bot->player;
+
+    if (player->sockfd == bot->serverFd) {
+        if (find_session_by_username(player->username)) {
+            disconnect_player(player);
+        } else {
+            output_release(player->sockfd);
+            close(player->sockfd);
+            FD_CLR(player->sockfd, &all_fds);
+            clear_player_data(player);
+        }
+    }
+
+    FD_CLR(bot->peerFd, &all_fds);
+    close(bot->peerFd);
+
+    bot->player = NULL;
+    bot->serverFd = -1;
+    bot->peerFd = -1;
+    bot->generation++;
+    printf("Bot seat %d released.\n", (int)(bot - bots));
+}
+
+static void handle_server_line(Bot *bot, const char *line) {
+    if (strncmp(line, "KIVUPSHEARTBEAT", 15) == 0) {
+        bot_send(bot, "heartB", NULL);
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_INVALID", 25) == 0) {
+        bot->invalidMoves++;
+        bot->awaitingReply = 0;
+    } else if (strncmp(line, "KIVUPSTURN_SWITCH", 17) == 0 ||
+               strncmp(line, "KIVUPSGAME_OVER", 15) == 0) {
+        bot->awaitingReply = 0;
+    }
+}
+
+static void drain_peer(Bot *bot) {
+    int n;
+    while ((n = read(bot->peerFd, bot->inbox + bot->inboxLen, sizeof(bot->inbox) - bot->inboxLen - 1)) > 0) {
+        bot->inboxLen += n;
+        bot->inbox[bot->inboxLen] = '\0';
+
+        char *start = bot->inbox;
+        char *newline;
+        while ((newline = strchr(start, '\n')) != NULL) {
+            *newline = '\0';
+            handle_server_line(bot, start);
+            start = newline + 1;
+        }
+
+        bot->inboxLen -= start - bot->inbox;
+        memmove(bot->inbox, start, bot->inboxLen);
+        if (bot->inboxLen >= (int)sizeof(bot->inbox) - 1) bot->inboxLen = 0;
+    }
+}
+
+static void apply_result(const BotResult *result) {
+    if (result->bot < 0 || result->bot >= MAX_BOTS) return;
+
+    Bot *bot = &bots[result->bot];
+    if (!bot->player || bot->generation != result->generation) return;
+    bot->jobPending = 0;
+
+    GameSession *session = find_session_by_username(bot->player->username);
+    if (!session || session->players[session->currentTurn] != bot->player) return;
+
+    char card[16];
+    const Move *move = &result->move;
+    switch (move->type) {
+    case MOVE_PLAY:
+        rules_card_name(move->card, card, sizeof(card));
+        bot_send(bot, "playCa", card);
+        if (CARD_VALUE(move->card) == VALUE_QUEEN) {
+            bot_send(bot, "suitCh", rules_suit_name(move->suit));
+        }
+        break;
+    case MOVE_DRAW:
+        bot_send(bot, "drawCa", NULL);
+        break;
+    case MOVE_SKIP:
+        bot_send(bot, "skipMv", NULL);
+        break;
+    case MOVE_FORCE_DRAW:
+        bot_send(bot, "forceD", NULL);
+        break;
+    }
+    bot->awaitingReply = 1;
+
+    printf("Bot %s decided after %d rollouts in %.1f ms (win rate %.2f).\n", bot->player->username,
+           result->stats.rollouts, result->stats.elapsedMs, result->stats.winRate);
+}
+
+void bot_handle_io(fd_set *read_fds) {
+    (void)read_fds;
+    if (!bots_enabled()) return;
+
+    // Peers are drained first so replies to earlier moves are seen before new ones go out
+    for (int i = 0; i < MAX_BOTS; i++) {
+        if (bots[i].player) {
+            flush_outbox(&bots[i]);
+            drain_peer(&bots[i]);
+        }
+    }
+
+    BotResult result;
+    while (read(result_pipe[0], &result, sizeof(result)) == sizeof(result)) {
+        apply_result(&result);
+    }
+}
+
+static int load_cards(uint8_t *out, const char cards[][BUFFER_SIZE], int count) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        int card = rules_card_from_name(cards[i]);
+        if (card >= 0) out[n++] = (uint8_t)card;
+    }
+    return n;
+}
+
+static int snapshot_session(const GameSession *session, int seat, CompactGame *game) {
+    memset(game, 0, sizeof(*game));
+    game->winner = RULES_NO_WINNER;
+
+    for (int p = 0; p < 2; p++) {
+        Player *player = session->players[p];
+        if (!player) return -1;
+        game->handSize[p] = load_cards(game->hand[p], (const char (*)[BUFFER_SIZE])player->hand, player->handSize);
+    }
+
+    game->drawTop = load_cards(game->drawPile, session->drawDeck.deck,
+                               session->drawDeck.topCardIndex + 1) - 1;
+    game->discardTop = load_cards(game->discardPile, session->discardDeck.deck,
+                                  session->discardDeck.topCardIndex + 1) - 1;
+
+    char active[24];
+    snprintf(active, sizeof(active), "%s_%s", session->activeSuit, session->activeValue);
+    int card = rules_card_from_name(active);
+    if (card < 0) return -1;
+
+    game->activeSuit = CARD_SUIT(card);
+    game->activeValue = CARD_VALUE(card);
+    game->currentTurn = (uint8_t)seat;
+    game->skipPending = session->skipPending ? 1 : 0;
+    game->forceDrawCount = session->force_draw_pending ? (uint8_t)session->force_draw_count : 0;
+    return 0;
+}
+
+static void schedule_decision(Bot *bot, GameSession *session) {
+    BotJob job;
+    job.bot = (int)(bot - bots);
+    job.generation = bot->generation;
+    job.seed = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+
+    if (snapshot_session(session, session->currentTurn, &job.game) < 0) {
+        printf("Bot %s could not read the session state.\n", bot->player->username);
+        return;
+    }
+
+    // After a rejected move fall back to the move that is always legal
+    if (bot->invalidMoves > 0) {
+        Move moves[RULES_MAX_MOVES];
+        int count = rules_legal_moves(&job.game, moves);
+        BotResult result = {job.bot, job.generation, moves[count - 1], {0}};
+        bot->invalidMoves = 0;
+        bot->jobPending = 1;
+        apply_result(&result);
+        return;
+    }
+
+    pthread_mutex_lock(&job_lock);
+    job_queue[(job_head + job_count) % MAX_BOTS] = job;
+    job_count++;
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+    bot->jobPending = 1;
+}
+
+void bot_tick() {
+    if (!bots_enabled()) return;
+
+    int joining = 0;
+    for (int i = 0; i < MAX_BOTS; i++) {
+        Bot *bot = &bots[i];
+        if (!bot->player) continue;
+
+        Player *player = bot->player;
+        if (player->sockfd != bot->serverFd) {
+            // The server already dropped this seat (protocol error, heartbeat)
+            release_bot(bot);
+            continue;
+        }
+
+        if (!bot->joined) {
+            if (player->state == STATE_IDLE) {
+                joining = 1;
+                continue;
+            }
+            bot->joined = 1;
+        }
+
+        GameSession *session = find_session_by_username(player->username);
+        if (player->state == STATE_WAITING) {
+            int humans_waiting = 0;
+            for (int j = 0; j < MAX_PLAYERS; j++) {
+                if (&players[j] != player && players[j].state == STATE_WAITING) humans_waiting = 1;
+            }
+            if (!humans_waiting) release_bot(bot);
+            continue;
+        }
+
+        if (player->state != STATE_PLAYING || !session) {
+            release_bot(bot);
+            continue;
+        }
+
+        Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
+        if (!opponent || opponent->sockfd == -1) {
+            release_bot(bot);
+            continue;
+        }
+
+        if (session->players[session->currentTurn] == player && !bot->jobPending && !bot->awaitingReply) {
+            schedule_decision(bot, session);
+        }
+    }
+
+    if (joining) return;
+
+    // Seat a bot next to the longest waiting player once the timeout passes
+    time_t now = time(NULL);
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        Player *player = &players[i];
+        if (player->state == STATE_WAITING && !is_bot_player(player) &&
+            player->queueTime && now - player->queueTime >= config()->botTimeout) {
+            printf("Player %s waited %d s in the queue. Adding a bot.\n", player->username, config()->botTimeout);
+            spawn_bot();
+            break;
+        }
+    }
+}
+
+int bot_seat_info(int seat, Player **player, int *peer_fd, int *joined, int *awaiting_reply) {
+    if (seat < 0 || seat >= MAX_BOTS || !bots[seat].player) return -1;
+
+    *player = bots[seat].player;
+    *peer_fd = bots[seat].peerFd;
+    *joined = bots[seat].joined;
+    *awaiting_reply = bots[seat].awaitingReply;
+    return 0;
+}
+
+int bot_adopt(Player *player, int peer_fd, int joined, int awaiting_reply) {
+    if (!bots_enabled()) return -1;
+
+    for (int i = 0; i < MAX_BOTS; i++) {
+        Bot *bot = &bots[i];
+        if (bot->player) continue;
+
+        bot->player = player;
+        bot->serverFd = player->sockfd;
+        bot->peerFd = peer_fd;
+        bot->joined = joined;
+        bot->jobPending = 0;   // Decisions in flight died with the old process
+        bot->awaitingReply = awaiting_reply;
+        bot->invalidMoves = 0;
+        bot->inboxLen = 0;
+        bot->outboxLen = 0;
+
+        fcntl(peer_fd, F_SETFL, O_NONBLOCK);
+        FD_SET(peer_fd, &all_fds);
+        if (peer_fd > max_fd) max_fd = peer_fd;
+        return 0;
+    }
+    return -1;
+}
+
+void bot_detach(int seat) {
+    // The seat moved to another process; its descriptors are closed by the caller
+    if (seat < 0 || seat >= MAX_BOTS || !bots[seat].player) return;
+
+    Bot *bot = &bots[seat];
+    FD_CLR(bot->peerFd, &all_fds);
+    bot->player = NULL;
+    bot->serverFd = -1;
+    bot->peerFd = -1;
+    bot->generation++;
+}
+
+int bot_jobs_queued() {
+    pthread_mutex_lock(&job_lock);
+    int count = job_count;
+    pthread_mutex_unlock(&job_lock);
+    return count;
+}
+
+int bot_worker_load(int worker, BotWorkerLoad *out) {
+    if (!bots_enabled() || worker < 0 || worker >= config()->botWorkers) return -1;
+
+    pthread_mutex_lock(&job_lock);
+    *out = worker_load[worker];
+    pthread_mutex_unlock(&job_lock);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include "game.h"
+#include <sys/select.h>
+
+#define MAX_BOTS MAX_SESSIONS
+#define BOT_MAX_ROLLOUTS 20000
+
+typedef struct {
+    unsigned long decisions;
+    double busyMs;
+} BotWorkerLoad;
+
+void init_bots();
+int bots_enabled();
+int is_bot_player(const Player *player);
+void bot_handle_io(fd_set *read_fds);
+void bot_tick();
+int bot_seat_info(int seat, Player **player, int *peer_fd, int *joined, int *awaiting_reply);
+int bot_adopt(Player *player, int peer_fd, int joined, int awaiting_reply);
+void bot_detach(int seat);
+int bot_jobs_queued();
+int bot_worker_load(int worker, BotWorkerLoad *out);
+
+#endif
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "game.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <sched.h>
+
+// Settings come from three layers: the defaults below, the file given with
+// --config and the command line, which always wins. Each option has the
+// same name in the file ("rate = 50") and on the command line (--rate 50).
+
+typedef struct {
+    const char *name;
+    size_t offset;
+    int min;
+    int max;
+    int reloadable;
+} ConfigKey;
+
+static const ConfigKey keys[] = {
+    {"listen-backlog",        offsetof(Config, listenBacklog),       1, 65535,        0},
+    {"heartbeat-check",       offsetof(Config, heartbeatCheck),      0, 1,            0},
+    {"bot-timeout",           offsetof(Config, botTimeout),          0, 86400,        0},
+    {"bot-workers",           offsetof(Config, botWorkers),          1, 256,          0},
+    {"loop-cpu",              offsetof(Config, loopCpu),             -1, CPU_SETSIZE - 1, 0},
+    {"worker-cpu",            offsetof(Config, workerCpu),           -1, CPU_SETSIZE - 1, 0},
+    {"huge-pages",            offsetof(Config, hugePages),           0, 1,            0},
+    {"prefault",              offsetof(Config, prefault),            0, 1,            0},
+    {"max-players",           offsetof(Config, maxPlayers),          2, MAX_PLAYERS,  1},
+    {"max-sessions",          offsetof(Config, maxSessions),         1, MAX_SESSIONS, 1},
+    {"heartbeat-interval",    offsetof(Config, heartbeatIntervalMs), 100, 600000,     1},
+    {"max-missed-heartbeats", offsetof(Config, maxMissedHeartbeats), 1, 1000000,      1},
+    {"heartbeat-idle",        offsetof(Config, heartbeatIdleMs),     0, 3600000,      1},
+    {"rtt-match-wait",        offsetof(Config, rttMatchWait),        0, 3600,         1},
+    {"tcp-keepalive",         offsetof(Config, tcpKeepalive),        0, 32767,        1},
+    {"tcp-user-timeout",      offsetof(Config, tcpUserTimeoutMs),    0, 3600000,      1},
+    {"tcp-nodelay",           offsetof(Config, tcpNodelay),          0, 1,            1},
+    {"output-coalesce",       offsetof(Config, outputCoalesce),      OUTPUT_DIRECT, OUTPUT_CORK, 1},
+    {"coalesce-max-us",       offsetof(Config, coalesceMaxUs),       0, 1000000,      1},
+    {"hand-size",             offsetof(Config, handSize),            1, (DECK_SIZE - 1) / 2, 1},
+    {"max-per-ip",            offsetof(Config, maxPerIp),            0, 1000000,      1},
+    {"rate",                  offsetof(Config, rate),                0, 1000000,      1},
+    {"burst",                 offsetof(Config, burst),               1, 1000000,      1},
+    {"overload-ms",           offsetof(Config, overloadMs),          0, 60000,        1},
+    {"budget-reconnect",      offsetof(Config, budgetReconnect),     0, 1000000,      1},
+    {"budget-queue",          offsetof(Config, budgetQueue),         0, 1000000,      1},
+    {"budget-liveness",       offsetof(Config, budgetLiveness),      0, 1000000,      1},
+    {"bot-budget",            offsetof(Config, botBudgetMs),         1, 60000,        1},
+    {"log-level",             offsetof(Config, logLevel),            LOG_INFO, LOG_DEBUG, 1},
+};
+#define KEY_COUNT (int)(sizeof(keys) / sizeof(keys[0]))
+
+static const Config defaults = {
+    .listenBacklog = 3,
+    .heartbeatCheck = 1,
+    .botTimeout = 0,
+    .botWorkers = 2,
+    .loopCpu = -1,
+    .workerCpu = -1,
+    .hugePages = 0,
+    .prefault = 0,
+    .maxPlayers = MAX_PLAYERS,
+    .maxSessions = MAX_SESSIONS,
+    .heartbeatIntervalMs = 2000,
+    .maxMissedHeartbeats = 20,
+    .heartbeatIdleMs = 2500,
+    .rttMatchWait = 10,
+    .tcpKeepalive = 0,
+    .tcpUserTimeoutMs = 0,
+    .tcpNodelay = 1,
+    .outputCoalesce = OUTPUT_DIRECT,
+    .coalesceMaxUs = 2000,
+    .handSize = 5,
+    .maxPerIp = 16,
+    .rate = 20,
+    .burst = 40,
+    .overloadMs = 50,
+    .budgetReconnect = 32,
+    .budgetQueue = 16,
+    .budgetLiveness = 64,
+    .botBudgetMs = 50,
+    .logLevel = LOG_DEBUG,
+};
+
+_Atomic(const Config *) current_config = &defaults;
+volatile sig_atomic_t config_reload_requested = 0;
+
+static const char *config_path;
+static const char *override_keys[CONFIG_MAX_OVERRIDES];
+static const char *override_values[CONFIG_MAX_OVERRIDES];
+static int override_count = 0;
+static Config *retired;   // Previous snapshot, freed on the next reload
+
+static const ConfigKey *find_key(const char *name) {
+    for (int i = 0; i < KEY_COUNT; i++) {
+        if (strcmp(keys[i].name, name) == 0) return &keys[i];
+    }
+    return NULL;
+}
+
+static int set_value(Config *target, const char *name, const char *value) {
+    const ConfigKey *key = find_key(name);
+    if (!key) {
+        fprintf(stderr, "Unknown setting %s\n", name);
+        return -1;
+    }
+
+    char *end;
+    long number;
+    if (key->offset == offsetof(Config, logLevel) && !isdigit((unsigned char)value[0])) {
+        number = strcmp(value, "debug") == 0 ? LOG_DEBUG : strcmp(value, "info") == 0 ? LOG_INFO : -1;
+        end = "";
+    } else if (key->offset == offsetof(Config, outputCoalesce) && !isdigit((unsigned char)value[0])) {
+        number = strcmp(value, "off") == 0 ? OUTPUT_DIRECT : strcmp(value, "gather") == 0 ? OUTPUT_GATHER :
+                 strcmp(value, "cork") == 0 ? OUTPUT_CORK : -1;
+        end = "";
+    } else {
+        number = strtol(value, &end, 10);
+    }
+    if (!*value || *end || number < key->min || number > key->max) {
+        fprintf(stderr, "Invalid value %s for %s (allowed %d..%d)\n", value, name, key->min, key->max);
+        return -1;
+    }
+    *(int *)((char *)target + key->offset) = (int)number;
+    return 0;
+}
+
+static int read_file(Config *target, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    int line_number = 0, failed = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        char name[64], value[64];
+        int fields = sscanf(line, " %63[^= \t] = %63s", name, value);
+        if (fields == EOF) continue;   // Blank or comment
+        if (fields != 2) {
+            fprintf(stderr, "%s:%d: expected name = value\n", path, line_number);
+            failed = 1;
+        } else if (set_value(target, name, value) < 0) {
+            fprintf(stderr, "%s:%d: setting ignored\n", path, line_number);
+            failed = 1;
+        }
+    }
+    fclose(file);
+    return failed ? -1 : 0;
+}
+
+static int build(Config *target) {
+    *target = defaults;
+    if (config_path && read_file(target, config_path) < 0) return -1;
+    for (int i = 0; i < override_count; i++) {
+        if (set_value(target, override_keys[i], override_values[i]) < 0) return -1;
+    }
+    // A heartbeat can leave up to one interval after heartbeat-idle runs out
+    if (target->heartbeatCheck && target->heartbeatIdleMs + target->heartbeatIntervalMs >= CLIENT_TIMEOUT_MS) {
+        fprintf(stderr, "Warning: heartbeat-idle + heartbeat-interval is %d ms; the client drops a connection "
+                        "after %d ms without a message.\n",
+                target->heartbeatIdleMs + target->heartbeatIntervalMs, CLIENT_TIMEOUT_MS);
+    }
+    return 0;
+}
+
+int config_is_key(const char *key) {
+    return find_key(key) != NULL;
+}
+
+int config_override(const char *key, const char *value) {
+    if (override_count == CONFIG_MAX_OVERRIDES) {
+        fprintf(stderr, "Too many options\n");
+        return -1;
+    }
+
+    // Checked now so a typo stops the server before it starts
+    Config scratch = defaults;
+    if (set_value(&scratch, key, value) < 0) return -1;
+    override_keys[override_count] = key;
+    override_values[override_count] = value;
+    override_count++;
+    return 0;
+}
+
+int config_load(const char *path) {
+    Config *next = malloc(sizeof(Config));
+    config_path = path;
+    if (!next || build(next) < 0) {
+        free(next);
+        return -1;
+    }
+    atomic_store_explicit(&current_config, next, memory_order_release);
+    if (path) printf("Configuration read from %s.\n", path);
+    return 0;
+}
+
+void config_reload() {
+    const Config *old = config();
+    Config *next = malloc(sizeof(Config));
+    if (!next || build(next) < 0) {
+        free(next);
+        printf("Configuration reload failed. Keeping the current settings.\n");
+        return;
+    }
+
+    // Startup settings keep their running value
+    for (int i = 0; i < KEY_COUNT; i++) {
+        if (keys[i].reloadable) continue;
+        int *now = (int *)((char *)old + keys[i].offset);
+        int *wanted = (int *)((char *)next + keys[i].offset);
+        if (*now != *wanted) {
+            printf("Setting %s changes only after a restart.\n", keys[i].name);
+            *wanted = *now;
+        }
+    }
+    for (int i = 0; i < KEY_COUNT; i++) {
+        int before = *(const int *)((const char *)old + keys[i].offset);
+        int after = *(int *)((char *)next + keys[i].offset);
+        if (before != after) printf("Setting %s: %d -> %d.\n", keys[i].name, before, after);
+    }
+
+    atomic_store_explicit(&current_config, next, memory_order_release);
+    // Readers hold a snapshot for one loop iteration or check pass, far
+    // shorter than the time between two reloads
+    free(retired);
+    retired = (Config *)old != &defaults ? (Config *)old : NULL;
+    printf("Configuration reloaded.\n");
+}
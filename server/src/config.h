@@ -0,0 +1,68 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define CONFIG_MAX_OVERRIDES 64
+#define CLIENT_TIMEOUT_MS 5000   // The Java client drops a connection after this long without a message
+
+typedef enum {
+    LOG_INFO,
+    LOG_DEBUG    // Also every message sent and every heartbeat
+} LogLevel;
+
+// Tunables from the config file and the command line. A snapshot is never
+// changed once published; SIGHUP builds a new one and swaps the pointer.
+typedef struct {
+    // Read once at startup
+    int listenBacklog;
+    int heartbeatCheck;        // 0 = no heartbeat thread
+    int botTimeout;            // Seconds a player waits before a bot joins, 0 = bots disabled
+    int botWorkers;            // Threads running rollouts
+    int loopCpu;               // CPU for the event loop, -1 = unpinned
+    int workerCpu;             // Bot worker i runs on workerCpu + i, -1 = unpinned
+    int hugePages;             // Advise transparent huge pages for players[] and sessions[]
+    int prefault;              // Touch every page of players[] and sessions[] at startup
+
+    // Applied on reload
+    int maxPlayers;            // Connection slots in use, at most MAX_PLAYERS
+    int maxSessions;           // At most MAX_SESSIONS
+    int heartbeatIntervalMs;
+    int maxMissedHeartbeats;
+    int heartbeatIdleMs;       // Quiet time before a connection gets a heartbeat
+    int rttMatchWait;          // Seconds in the queue before round trip no longer picks the opponent, 0 = off
+    int tcpKeepalive;          // Seconds before TCP keepalive probes, 0 = off; new connections
+    int tcpUserTimeoutMs;      // TCP_USER_TIMEOUT, 0 = kernel default; new connections
+    int tcpNodelay;            // TCP_NODELAY on new connections
+    int outputCoalesce;        // OutputMode
+    int coalesceMaxUs;         // Longest a message is held before the tick is flushed early
+    int handSize;
+    int maxPerIp;              // 0 = no per-IP cap
+    int rate;                  // Commands per second per connection, 0 = unlimited
+    int burst;
+    int overloadMs;            // Loop work time that switches on overload mode
+    int budgetReconnect;       // Commands of each class served per loop iteration, 0 = no limit
+    int budgetQueue;
+    int budgetLiveness;
+    int botBudgetMs;           // Time budget for one Monte Carlo decision
+    int logLevel;
+} Config;
+
+extern _Atomic(const Config *) current_config;
+extern volatile sig_atomic_t config_reload_requested;
+
+// Lock free; a caller keeps the pointer for one pass at most
+static inline const Config *config() {
+    return atomic_load_explicit(&current_config, memory_order_acquire);
+}
+
+#define log_debug(...) do { if (config()->logLevel >= LOG_DEBUG) printf(__VA_ARGS__); } while (0)
+
+int config_is_key(const char *key);
+int config_override(const char *key, const char *value);
+int config_load(const char *path);
+void config_reload();
+
+#endif
@@ -1,13 +1,22 @@
+#define _GNU_SOURCE
 #include "game.h"
 #include "network.h"
+#include "spectator.h"
+#include "recorder.h"
+#include "config.h"
+#include "output.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <stdatomic.h>
 
 GameSession sessions[MAX_SESSIONS];
 
@@ -42,11 +51,12 @@ void deal_initial_hands(GameSession *session) {
         return;
     }
 
-    // Deal 5 cards to each player
+    // Deal the configured number of cards to each player
+    int hand_size = config()->handSize;
     for (int i = 0; i < 2; i++) {
         session->players[i]->handSize = 0;
 
-        for (int j = 0; j < 5; j++) {
+        for (int j = 0; j < hand_size; j++) {
             if (session->drawDeck.topCardIndex < 0) {
                 printf("Warning: Not enough cards in draw deck to deal to player %s.\n", session->players[i]->username);
                 return;  // Stop dealing if the deck is empty
@@ -65,12 +75,14 @@ void deal_initial_hands(GameSession *session) {
         }
     }
 
-    printf("Initial hands dealt successfully.\n");
+    log_debug("Initial hands dealt successfully.\n");
 }
 
 void reshuffle_discard_to_draw(GameSession *session) {
+    TRACE2(reshuffle, trace_session(session), session->discardDeck.topCardIndex + 1);
     if (session->discardDeck.topCardIndex < 1) {
         printf("Not enough cards to reshuffle.\n");
+        recorder_note(session, NULL, "reshuffle: discard pile has %d", session->discardDeck.topCardIndex + 1);
         return;
     }
 
@@ -91,11 +103,24 @@ void reshuffle_discard_to_draw(GameSession *session) {
     strncpy(session->discardDeck.deck[0], last_card, BUFFER_SIZE - 1);
     session->discardDeck.deck[0][BUFFER_SIZE - 1] = '\0';
 
+    recorder_note(session, NULL, "reshuffle: draw pile now %d", session->drawDeck.topCardIndex + 1);
     printf("Discard deck reshuffled into draw deck.\n");
 }
 
+GameSession *allocate_session() {
+    // Ended games free their slot in place, so live sessions can sit anywhere in the array
+    int limit = config()->maxSessions;
+    for (int i = 0; i < limit; i++) {
+        if (!sessions[i].players[0] && !sessions[i].players[1]) {
+            session_count++;
+            return &sessions[i];
+        }
+    }
+    return NULL;
+}
+
 GameSession* find_session_by_username(const char* username) {
-    for (int i = 0; i < session_count; i++) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
         GameSession *session = &sessions[i];
 
         // Skip cleared sessions
@@ -114,6 +139,7 @@ GameSession* find_session_by_username(const char* username) {
 
 void start_game(GameSession *session) {
     printf("Starting game session...\n");
+    recorder_reset(session);
 
     // Clear and reset session decks
     memset(session->drawDeck.deck, 0, sizeof(session->drawDeck.deck));
@@ -139,22 +165,32 @@ void start_game(GameSession *session) {
 
     // Randomize the starting player
     session->currentTurn = rand() % 2;
+    recorder_note(session, NULL, "start, top %s_%s, seat %d begins", session->activeSuit, session->activeValue,
+                  session->currentTurn);
 
     // Broadcast the initial game state to both players
     broadcast_game_state(session, -1, 1); // Unified function with broadcast
 }
 
+// Appends at len and returns the new length, which stays inside the buffer once it is full
+static int append_state(char *buffer, int size, int len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + len, size - len, format, args);
+    va_end(args);
+    if (written < 0) return len;
+    return len + written < size ? len + written : size - 1;
+}
+
 void broadcast_game_state(GameSession *session, int playerIndex, int broadcast) {
     if (!session) {
         printf("Error: Invalid session.\n");
         return;
     }
+    TRACE3(broadcast_state, trace_session(session), playerIndex, broadcast);
 
-    char gameState[BUFFER_SIZE] = "KIVUPSgameSt";
-    strcat(gameState, "0000");  // Placeholder for possible future message length
-
-    char discardCard[BUFFER_SIZE];
-    snprintf(discardCard, sizeof(discardCard), "%s_%s", session->activeSuit, session->activeValue);
+    // A full hand of 32 cards fits with room to spare
+    char gameState[2 * BUFFER_SIZE];
 
     for (int i = 0; i < 2; i++) {
         if (!broadcast && i != playerIndex) continue; // Skip other players if not broadcasting
@@ -169,28 +205,29 @@ void broadcast_game_state(GameSession *session, int playerIndex, int broadcast)
             continue;
         }
 
-        // Prepare the player's hand information
-        char handInfo[BUFFER_SIZE] = "";
-        for (int j = 0; j < player->handSize; j++) {
-            strncat(handInfo, player->hand[j], BUFFER_SIZE - strlen(handInfo) - 2);
-            if (j < player->handSize - 1) strncat(handInfo, ",", 1);
-        }
-
         // Opponent's card count
         int opponentCardCount = (opponent && opponent->sockfd != -1) ? opponent->handSize : 0;
 
-        // Build the game state message
-        snprintf(gameState + 14, BUFFER_SIZE - 14, "P%d:%s|D:%s|O:%d|T:%d|%s\n",
-                 i + 1, handInfo, discardCard, opponentCardCount,
-                 (session->currentTurn == i ? 1 : 0),
-                 (session->skipPending ? "SKIP_PENDING" :
-                  session->force_draw_count > 0 ? "FORCE_DRAW_PENDING" : ""));
+        // Build the game state message; "00" is a placeholder for a future message length
+        int size = sizeof(gameState);
+        int len = append_state(gameState, size, 0, "KIVUPSgameSt00P%d:", i + 1);
+        for (int j = 0; j < player->handSize; j++) {
+            len = append_state(gameState, size, len, j ? ",%s" : "%s", player->hand[j]);
+        }
+        append_state(gameState, size, len, "|D:%s_%s|O:%d|T:%d|%s\n",
+                     session->activeSuit, session->activeValue, opponentCardCount,
+                     (session->currentTurn == i ? 1 : 0),
+                     (session->skipPending ? "SKIP_PENDING" :
+                      session->force_draw_count > 0 ? "FORCE_DRAW_PENDING" : ""));
 
         // Send the game state to the player
-        if (send(player->sockfd, gameState, strlen(gameState), 0) == -1) {
+        recorder_sent(session, player, gameState);
+        if (output_send(player->sockfd, gameState, strlen(gameState)) == -1) {
             perror("Failed to send game state");
         } else {
-            printf("Game state sent to player %s.\n", player->username);
+            log_debug("Game state sent to player %s.\n", player->username);
+            // The player to move answers this one
+            if (session->currentTurn == i) note_probe_sent(player);
         }
 
         // If sending to a specific player, break after sending
@@ -200,6 +237,11 @@ void broadcast_game_state(GameSession *session, int playerIndex, int broadcast)
 
 void cleanup_session(GameSession *session) {
     if (!session) return; // Validate session
+    TRACE3(session_cleanup, trace_session(session), trace_player(session->players[0]),
+           trace_player(session->players[1]));
+
+    recorder_note(session, NULL, "cleanup");
+    spectator_end_session(session);
 
     for (int i = 0; i < 2; i++) {
         if (session->players[i]) { // Check if the player pointer is valid
@@ -220,9 +262,30 @@ void cleanup_session(GameSession *session) {
     printf("Session cleanup complete.\n");
 }
 
+void terminate_session(GameSession *session) {
+    // Both players go back to the lobby with their connection and name
+    for (int i = 0; i < 2; i++) {
+        Player *player = session->players[i];
+        if (!player) continue;
+
+        int sockfd = player->sockfd;
+        char username[BUFFER_SIZE];
+        strncpy(username, player->username, BUFFER_SIZE);
+        if (sockfd != -1) {
+            recorder_sent(session, player, "KIVUPSSESSION_TERMINATED\n");
+            output_send(sockfd, "KIVUPSSESSION_TERMINATED\n", 25);
+        }
+
+        clear_player_data(player);
+        player->sockfd = sockfd;
+        strncpy(player->username, username, BUFFER_SIZE);
+    }
+    cleanup_session(session);
+}
+
 void parse_card_info(const char *card, char *suit, char *value) {
     char card_copy[20];
-    strncpy(card_copy, card, sizeof(card_copy));
+    snprintf(card_copy, sizeof(card_copy), "%s", card);
     char *suit_token = strtok(card_copy, "_");
     char *value_token = strtok(NULL, "_");
 
@@ -252,7 +315,7 @@ void send_validation_response(int sockfd, int is_valid, const char *card_name, i
         message[sizeof(message) - 1] = '\0';
     }
 
-    if (send(sockfd, message, strlen(message), 0) == -1) {
+    if (output_send(sockfd, message, strlen(message)) == -1) {
         perror("Failed to send validation response");
     }
 }
@@ -262,6 +325,8 @@ void switch_turn(GameSession *session) {
 
     // Switch to the next player
     session->currentTurn = (session->currentTurn + 1) % 2;
+    TRACE3(switch_turn, trace_session(session), session->currentTurn,
+           trace_player(session->players[session->currentTurn]));
 
     for (int i = 0; i < 2; i++) {
         Player *player = session->players[i];
@@ -273,18 +338,85 @@ void switch_turn(GameSession *session) {
         int isMyTurn = (i == session->currentTurn);
         char message[BUFFER_SIZE];
         snprintf(message, sizeof(message), "KIVUPSTURN_SWITCH|%d\n", isMyTurn);
+        recorder_sent(session, player, message);
 
-        if (send(player->sockfd, message, strlen(message), 0) == -1) {
+        if (output_send(player->sockfd, message, strlen(message)) == -1) {
             perror("Failed to send turn switch notification");
         } else {
-            printf("Notified Player %s: %s turn.\n", player->username, isMyTurn ? "their" : "not their");
+            log_debug("Notified Player %s: %s turn.\n", player->username, isMyTurn ? "their" : "not their");
+            if (isMyTurn) note_probe_sent(player);
         }
     }
 
-    printf("Turn switched. Now it's Player %s's turn.\n", session->players[session->currentTurn]->username);
+    spectator_publish(session, "KIVUPSSPECTATE_TURN|%d\n", session->currentTurn);
+    Player *next = session->players[session->currentTurn];
+    log_debug("Turn switched. Now it's Player %s's turn.\n", next ? next->username : "(empty seat)");
+}
+
+static atomic_int flagged_count;  // Players the heartbeat thread flagged since the last pass
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// vDSO clock, no system call
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Smoothed like TCP's SRTT and RTTVAR (RFC 6298)
+static void add_rtt_sample(Player *player, long long sample) {
+    if (!player->rttUs) {
+        player->rttUs = (int)sample;
+        player->rttVarUs = (int)(sample / 2);
+    } else {
+        long long delta = sample > player->rttUs ? sample - player->rttUs : player->rttUs - sample;
+        player->rttVarUs = (int)((3LL * player->rttVarUs + delta) / 4);
+        player->rttUs = (int)((7LL * player->rttUs + sample) / 8);
+    }
+}
+
+// The next command from the player closes the probe; the timestamp rides on
+// the state push that goes out anyway
+void note_probe_sent(Player *player) {
+    if (player->probeSentUs) return;   // A heartbeat answer is the better sample
+    player->probeSentUs = now_us();
+    player->probeHeartbeat = 0;
+}
+
+// The checker thread only stamps the heartbeat; the probe fields are the loop's
+static void take_heartbeat_probe(Player *player) {
+    long long sent = atomic_exchange(&player->heartbeatSentUs, 0);
+    if (!sent) return;
+    player->probeSentUs = sent;
+    player->probeHeartbeat = 1;
+}
+
+// Any data from the peer answers an outstanding heartbeat
+void note_player_alive(Player *player) {
+    player->lastSeenMs = now_ms();
+    player->pendingHeartbeat = 0;
+    take_heartbeat_probe(player);
+
+    if (player->probeSentUs) {
+        long long sample = now_us() - player->probeSentUs;
+        // A state push is answered by a move, which only counts when it came
+        // back too fast for anyone to think or no slower than the estimate allows
+        if (player->probeHeartbeat || sample <= RTT_PUSH_MAX_US ||
+            (player->rttUs && sample <= player->rttUs + 4LL * player->rttVarUs)) {
+            add_rtt_sample(player, sample > 0 ? sample : 1);
+        }
+        player->probeSentUs = 0;
+    }
 }
 
 void check_player_activity() {
+    int max_missed = config()->maxMissedHeartbeats;
+    long long idle_since = now_ms() - config()->heartbeatIdleMs;
     for (int i = 0; i < MAX_PLAYERS; i++) {
         Player *player = &players[i];
 
@@ -296,60 +428,93 @@ void check_player_activity() {
         // Handle missed heartbeats
         if (player->pendingHeartbeat) {
             player->missedHeartbeats++;
+            TRACE2(heartbeat_missed, trace_player(player), player->missedHeartbeats);
             printf("Player %s missed heartbeat %d.\n", player->username, player->missedHeartbeats);
 
-            // Mark as disconnected on the first missed heartbeat
+            // Mark as disconnected on the first missed heartbeat; the loop
+            // thread records it and notifies the opponent
             if (player->missedHeartbeats == 1) {
                 printf("NO HEARTBEAT RESPONSE\n");
                 player->state = STATE_DISCONNECTED;
-
-                // Notify the opponent
-                GameSession *session = find_session_by_username(player->username);
-                if (session) {
-                    Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
-                    if (opponent && opponent->sockfd != -1) {
-                        if (send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 29, MSG_NOSIGNAL) == -1) {
-                            perror("Failed to notify opponent about disconnection");
-                        } else {
-                            printf("Notified opponent %s about player %s's disconnection.\n", opponent->username, player->username);
-                        }
-                    }
-                }
+                atomic_store(&player->missedNotice, 1);
+                atomic_fetch_add(&flagged_count, 1);
             }
 
-            // Cleanup the player if they exceed max missed heartbeats
-            if (player->missedHeartbeats >= MAX_MISSED_HEARTBEATS) {
-                if (player->state != STATE_DISCONNECTED) {
-                    printf("Player %s exceeded maximum missed heartbeats. Disconnecting.\n", player->username);
-
-                    GameSession *session = find_session_by_username(player->username);
-                    if (session) {
-                        Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
-                        if (opponent && opponent->sockfd != -1) {
-                            send(opponent->sockfd, "KIVUPSSESSION_TERMINATED\n", 28, MSG_NOSIGNAL);
-                            printf("Notified opponent %s about session termination.\n", opponent->username);
-                        }
-                        cleanup_session(session);
-                    }
-
-                    clear_player_data(player);  // Cleanup happens here only once
+            // Cleanup the player if they exceed max missed heartbeats; sessions,
+            // spectators and the player table belong to the loop thread
+            if (player->missedHeartbeats >= max_missed) {
+                if (player->state != STATE_DISCONNECTED && !player->expired) {
+                    player->expired = 1;
+                    atomic_fetch_add(&flagged_count, 1);
                 }
             }
         }
 
-        // Send a new heartbeat if none is pending
-        if (!player->pendingHeartbeat) {
-            if (send(player->sockfd, "KIVUPSHEARTBEAT\n", 16, MSG_NOSIGNAL) == -1) {
+        // A connection gets a heartbeat once it has been quiet for heartbeat-idle
+        // in either direction: a silent client may be gone, and a client the
+        // server has not written to treats the silence as a lost connection
+        if (!player->pendingHeartbeat &&
+            (player->lastSeenMs <= idle_since || output_last_sent_ms(player->sockfd) <= idle_since)) {
+            // Stamped before the send so an answer can never beat it to the loop
+            atomic_store(&player->heartbeatSentUs, now_us());
+            if (output_send(player->sockfd, "KIVUPSHEARTBEAT\n", 16) == -1) {
                 perror("Failed to send heartbeat");
+                atomic_store(&player->heartbeatSentUs, 0);
                 player->missedHeartbeats++;
             } else {
                 player->pendingHeartbeat = 1; // Await response
-                printf("Sent heartbeat to player %s.\n", player->username);
+                TRACE2(heartbeat_sent, trace_player(player), (int)player->state);
+                log_debug("Sent heartbeat to player %s.\n", player->username);
             }
         }
     }
 }
 
+static void notify_missed_heartbeat(Player *player) {
+    GameSession *session = find_session_by_username(player->username);
+    if (!session) return;
+
+    recorder_note(session, player, "missed heartbeat, marked disconnected");
+    Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
+    if (opponent && opponent->sockfd != -1) {
+        recorder_sent(session, opponent, "KIVUPSOPPONENT_DISCONNECTED\n");
+        if (output_send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 28) == -1) {
+            perror("Failed to notify opponent about disconnection");
+        } else {
+            printf("Notified opponent %s about player %s's disconnection.\n", opponent->username, player->username);
+        }
+    }
+}
+
+void handle_flagged_players() {
+    // Only a hint that a scan is worth it; a player cleared in the meantime costs one empty scan
+    if (!atomic_exchange(&flagged_count, 0)) return;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        Player *player = &players[i];
+        if (atomic_exchange(&player->missedNotice, 0) && player->sockfd != -1) {
+            notify_missed_heartbeat(player);
+        }
+        if (!player->expired) continue;
+        player->expired = 0;
+        if (player->sockfd == -1) continue;
+
+        printf("Player %s exceeded maximum missed heartbeats. Disconnecting.\n", player->username);
+
+        GameSession *session = find_session_by_username(player->username);
+        if (session) {
+            Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
+            if (opponent && opponent->sockfd != -1) {
+                recorder_sent(session, opponent, "KIVUPSSESSION_TERMINATED\n");
+                output_send(opponent->sockfd, "KIVUPSSESSION_TERMINATED\n", 25);
+                printf("Notified opponent %s about session termination.\n", opponent->username);
+            }
+            cleanup_session(session);
+        }
+
+        clear_player_data(player);  // Cleanup happens here only once
+    }
+}
+
 int is_socket_valid(int sockfd) {
     return fcntl(sockfd, F_GETFD) != -1 || errno != EBADF;
 }
\ No newline at end of file
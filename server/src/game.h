@@ -3,9 +3,10 @@
 
 #include "deck.h"
 
+#ifndef MAX_SESSIONS
 #define MAX_SESSIONS 10  // Maximum number of concurrent sessions
+#endif
 #define DECK_SIZE 32
-#define MAX_MISSED_HEARTBEATS 20
 
 typedef struct {
     Player *players[2];
@@ -17,6 +18,8 @@ typedef struct {
     int skipPending;   // New flag: 1 = Skip is pending, 0 = No skip
     int force_draw_pending;
     int force_draw_count;
+    int firstSpectator;             // Head of the spectator list, -1 when nobody watches
+    int spectatorCount;
 } GameSession;
 
 
@@ -25,14 +28,25 @@ extern int session_count;                  // Declare session_count as extern
 
 void deal_initial_hands(GameSession *session);
 void reshuffle_discard_to_draw(GameSession *session);
+GameSession *allocate_session();
 GameSession* find_session_by_username(const char* username);
 void start_game(GameSession *session);
 void broadcast_game_state(GameSession *session, int playerIndex, int broadcast);
 void cleanup_session(GameSession *session);
+void terminate_session(GameSession *session);
 void parse_card_info(const char *card, char *suit, char *value);
 int validate_move(const char *played_suit, const char *played_value, const char *active_suit, const char *active_value);
 void send_validation_response(int sockfd, int is_valid, const char *card_name, int game_over);
 void switch_turn(GameSession *session);
 void check_player_activity();
+// Acts on what check_player_activity flagged: tells opponents about missed
+// heartbeats and ends the sessions of players it gave up on; loop thread only
+void handle_flagged_players();
+void note_player_alive(Player *player);
+void note_probe_sent(Player *player);
 int is_socket_valid(int sockfd);
+
+// A move sent later than this after a state push had someone thinking
+// in between and says nothing about the network
+#define RTT_PUSH_MAX_US 250000
 #endif
\ No newline at end of file
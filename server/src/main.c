@@ -1,19 +1,40 @@
+#define _GNU_SOURCE
 #include "game.h"
 #include "player.h"
 #include "network.h"
+#include "bot.h"
+#include "spectator.h"
+#include "admission.h"
+#include "upgrade.h"
+#include "migrate.h"
+#include "admin.h"
+#include "recorder.h"
+#include "profile.h"
+#include "config.h"
+#include "placement.h"
+#include "output.h"
+#include "scheduler.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
+#include <signal.h>
 #include <net/if.h>
 #include <ifaddrs.h>
 
+#define MAX_UNIX_LISTENERS 4
+#define MAX_CLIENT_FDS MAX_PLAYERS
+
 fd_set all_fds;
 int max_fd;
 int session_count = 0;
@@ -59,27 +80,229 @@ void* periodic_check(void* arg) {
     (void)arg;
     while (1) {
         check_player_activity();
-        sleep(2); // Perform the check every 5 seconds
+        usleep(config()->heartbeatIntervalMs * 1000L);
+    }
+}
+
+void request_reload(int sig) {
+    (void)sig;
+    config_reload_requested = 1;
+}
+
+void request_drain(int sig) {
+    (void)sig;
+    migrate_drain_requested = 1;
+}
+
+// Keepalive and user timeout let the kernel notice dead peers that never
+// send a FIN; TCP_NODELAY stops Nagle from holding a move back for an ACK
+static void set_tcp_options(int fd) {
+    const Config *settings = config();
+    if (settings->tcpNodelay) {
+        int on = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+            perror("Failed to set TCP_NODELAY");
+        }
+    }
+    if (settings->tcpKeepalive > 0) {
+        int on = 1;
+        int idle = settings->tcpKeepalive;
+        int interval = idle / 3 > 0 ? idle / 3 : 1;
+        int count = 3;
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0) {
+            perror("Failed to enable TCP keepalive");
+        }
+    }
+    if (settings->tcpUserTimeoutMs > 0) {
+        unsigned int timeout = settings->tcpUserTimeoutMs;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) < 0) {
+            perror("Failed to set TCP user timeout");
+        }
+    }
+}
+
+// Every transport ends here: TCP and Unix accepts as well as inherited
+// descriptors. ip is 0 for local peers, which skip the per-IP cap.
+static void admit_connection(int new_socket, uint32_t ip, int is_tcp) {
+    // Find an available player slot
+    int slot = -1;
+    int limit = config()->maxPlayers;
+    for (int i = 0; i < limit; i++) {
+        if (players[i].sockfd == -1 && players[i].state != STATE_DISCONNECTED) {
+            slot = i;
+            break;
+        }
+    }
+
+    AdmissionVerdict verdict = admission_accept(new_socket, ip, slot >= 0);
+    if (verdict != ADMIT_OK) {
+        printf("Rejected connection (fd: %d): %s.\n", new_socket, admission_verdict_name(verdict));
+        send(new_socket, "KIVUPSSERVER_BUSY\n", 18, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(new_socket);
+        return;
+    }
+
+    if (is_tcp) {
+        set_tcp_options(new_socket);
+    }
+
+    FD_SET(new_socket, &all_fds);
+    if (new_socket > max_fd) max_fd = new_socket;
+
+    players[slot].sockfd = new_socket;
+    printf("Assigned new player to slot %d (fd: %d)\n", slot, new_socket);
+}
+
+void accept_connection(int listen_fd) {
+    struct sockaddr_storage address;
+    socklen_t addrlen = sizeof(address);
+
+    int new_socket = accept(listen_fd, (struct sockaddr *)&address, &addrlen);
+    if (new_socket < 0) return;
+    log_debug("New connection, socket fd: %d\n", new_socket);
+
+    // Unix peers (the router, local tools) count as local and skip the per-IP cap
+    int is_tcp = address.ss_family == AF_INET;
+    admit_connection(new_socket, is_tcp ? ((struct sockaddr_in *)&address)->sin_addr.s_addr : 0, is_tcp);
+}
+
+// A connected stream socket passed in by the parent, e.g. one end of a socketpair
+static int adopt_connection(int fd) {
+    int type;
+    socklen_t len = sizeof(type);
+    if (fcntl(fd, F_GETFD) < 0 || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM) {
+        fprintf(stderr, "Descriptor %d is not a stream socket.\n", fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    admit_connection(fd, 0, 0);
+    return 0;
+}
+
+int unix_listen(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Unix socket creation failed");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("Unix socket bind failed");
+        close(fd);
+        return -1;
     }
+
+    FD_SET(fd, &all_fds);
+    if (fd > max_fd) max_fd = fd;
+    printf("Accepting connections on %s.\n", path);
+    return fd;
 }
 
 int main(int argc, char *argv[]) {
-    // IP, PORT, PING CHECK
+    // IP, PORT, SETTINGS
     char ip[INET_ADDRSTRLEN] = { 0 };
     int port = 0;
-    int enable_check = 1;
+    const char *config_path = NULL;
+
+    // UPGRADE
+    const char *upgrade_socket_path = NULL;
+    const char *takeover_path = NULL;
+
+    // UNIX LISTENERS (the router's backend socket is one), INHERITED CLIENTS
+    const char *unix_paths[MAX_UNIX_LISTENERS];
+    int unix_fds[MAX_UNIX_LISTENERS];
+    int unix_count = 0;
+    int client_fds[MAX_CLIENT_FDS];
+    int client_fd_count = 0;
+
+    // MIGRATION
+    const char *migrate_socket_path = NULL;
+    int draining = 0;
+
+    // ADMIN, PERSISTENCE
+    const char *admin_socket_path = NULL;
+    const char *store_dir = NULL;
 
     // SOCKETS
-    int server_fd, new_socket;
+    int server_fd;
     struct sockaddr_in address;
-    socklen_t addrlen = sizeof(address);
 
-    if (argc > 1 && strcmp(argv[1], "--no-check") == 0) {
-        enable_check = 0;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--no-check") == 0) {
+            config_override("heartbeat-check", "0");
+        } else if (strcmp(argv[1], "--config") == 0 && argc > 2) {
+            config_path = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--upgrade-socket") == 0 && argc > 2) {
+            upgrade_socket_path = argv[2];
+            argv++;
+            argc--;
+        } else if ((strcmp(argv[1], "--backend-socket") == 0 || strcmp(argv[1], "--unix-socket") == 0) && argc > 2) {
+            if (unix_count == MAX_UNIX_LISTENERS) {
+                fprintf(stderr, "At most %d Unix sockets.\n", MAX_UNIX_LISTENERS);
+                exit(EXIT_FAILURE);
+            }
+            unix_paths[unix_count++] = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--client-fd") == 0 && argc > 2) {
+            if (client_fd_count == MAX_CLIENT_FDS) {
+                fprintf(stderr, "At most %d inherited clients.\n", MAX_CLIENT_FDS);
+                exit(EXIT_FAILURE);
+            }
+            client_fds[client_fd_count++] = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--migrate-socket") == 0 && argc > 2) {
+            migrate_socket_path = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--drain-to") == 0 && argc > 2) {
+            migrate_drain_path = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--admin-socket") == 0 && argc > 2) {
+            admin_socket_path = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--store") == 0 && argc > 2) {
+            store_dir = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--flight-dir") == 0 && argc > 2) {
+            recorder_dir = argv[2];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--takeover") == 0 && argc > 2) {
+            takeover_path = argv[2];
+            argv++;
+            argc--;
+        } else if (config_is_key(argv[1] + 2) && argc > 2) {
+            // Every setting of the config file also works as --name value
+            if (config_override(argv[1] + 2, argv[2]) < 0) exit(EXIT_FAILURE);
+            argv++;
+            argc--;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
         argv++; // Shift the argument array
         argc--; // Adjust the argument count
     }
-    if (argc > 1) {
+    // A successor inherits the listening socket, so it needs no address
+    if (!takeover_path && argc > 1) {
         strncpy(ip, argv[1], INET_ADDRSTRLEN - 1);
         ip[INET_ADDRSTRLEN - 1] = '\0'; // Ensure null termination
 
@@ -90,7 +313,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (argc > 2) {
+    if (!takeover_path && argc > 2) {
         port = atoi(argv[2]); // Convert port string to integer
         if (port <= 0 || port > 65535) {
             printf("INVALID PORT!");
@@ -98,108 +321,204 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (enable_check) {
-        pthread_t checker_thread;
-        pthread_create(&checker_thread, NULL, periodic_check, NULL);
-        pthread_detach(checker_thread);
-    }
-        server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("Socket creation failed");
+    if (config_load(config_path) < 0) {
         exit(EXIT_FAILURE);
     }
+    signal(SIGHUP, request_reload);
+
+    FD_ZERO(&all_fds);
+    max_fd = 0;
+
+    // A peer that goes away mid-broadcast must not take the whole process down
+    signal(SIGPIPE, SIG_IGN);
+
+    srand(time(NULL));
 
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt failed");
-        close(server_fd);
+    if (placement_setup() < 0) {
         exit(EXIT_FAILURE);
     }
 
-    address.sin_family = AF_INET;
-    if (inet_pton(AF_INET, ip, &address.sin_addr) <= 0) {
-        perror("Invalid address or address not supported");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+    init_players();
+    output_init();
+    init_bots();
+    init_spectators();
+
+    if (takeover_path) {
+        server_fd = upgrade_takeover(takeover_path);
+        if (server_fd < 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (!upgrade_socket_path) upgrade_socket_path = takeover_path;
+    } else if (!ip[0]) {
+        // Local transports only
+        server_fd = -1;
+        if (unix_count == 0 && client_fd_count == 0) {
+            fprintf(stderr, "Usage: %s [options] <ip> <port>, or --unix-socket <path> without ip and port\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (upgrade_socket_path) {
+            fprintf(stderr, "--upgrade-socket needs the TCP listener.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_fd < 0) {
+            perror("Socket creation failed");
+            exit(EXIT_FAILURE);
+        }
+
+        int opt = 1;
+        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            perror("setsockopt failed");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
+
+        address.sin_family = AF_INET;
+        if (inet_pton(AF_INET, ip, &address.sin_addr) <= 0) {
+            perror("Invalid address or address not supported");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
+        address.sin_port = htons(port);
+
+        if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+            perror("Bind failed");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
+
+        if (listen(server_fd, config()->listenBacklog) < 0) {
+            perror("Listen failed");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
+
+        FD_SET(server_fd, &all_fds);
+        if (server_fd > max_fd) max_fd = server_fd;
     }
-    address.sin_port = htons(port);
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("Bind failed");
-        close(server_fd);
+    if (upgrade_socket_path && upgrade_listen(upgrade_socket_path) < 0) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, 3) < 0) {
-        perror("Listen failed");
-        close(server_fd);
+    for (int i = 0; i < unix_count; i++) {
+        unix_fds[i] = unix_listen(unix_paths[i]);
+        if (unix_fds[i] < 0) exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < client_fd_count; i++) {
+        if (adopt_connection(client_fds[i]) < 0) exit(EXIT_FAILURE);
+    }
+
+    if (migrate_socket_path && migrate_listen(migrate_socket_path) < 0) {
         exit(EXIT_FAILURE);
     }
+    if (migrate_drain_path) {
+        signal(SIGUSR2, request_drain);
+    }
 
-    FD_ZERO(&all_fds);
-    FD_SET(server_fd, &all_fds);
-    max_fd = server_fd;
+    if (admin_socket_path && admin_listen(admin_socket_path) < 0) {
+        exit(EXIT_FAILURE);
+    }
 
-    srand(time(NULL));
+    if (store_dir && profile_open(store_dir) < 0) {
+        exit(EXIT_FAILURE);
+    }
 
-    init_players();
+    // Started after a takeover restored players[] so it never sees half a snapshot
+    if (config()->heartbeatCheck) {
+        pthread_t checker_thread;
+        pthread_create(&checker_thread, NULL, periodic_check, NULL);
+        pthread_detach(checker_thread);
+    }
 
     while (1) {
         fd_set read_fds = all_fds;
-        select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        fd_set write_fds;
+        FD_ZERO(&write_fds);
+        spectator_prepare_fds(&write_fds);
+        admin_prepare_fds(&write_fds);
+        // Bots need periodic wakeups for queue timeouts and finished decisions,
+        // draining moves one game per iteration
+        struct timeval tick = {0, draining ? 1000 : 100000};
+        // Commands held over by the scheduler run on the next pass without waiting
+        if (scheduler_waiting()) tick.tv_usec = 0;
+        // Otherwise a player the heartbeat thread gave up on waits at most one check
+        long check_ms = config()->heartbeatIntervalMs;
+        struct timeval check = {check_ms / 1000, (check_ms % 1000) * 1000};
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL,
+                   (bots_enabled() || draining || migrate_drain_requested || scheduler_waiting()) ? &tick : &check) < 0) {
+            // Interrupted by SIGUSR2 or SIGHUP; the sets are not valid
+            FD_ZERO(&read_fds);
+            FD_ZERO(&write_fds);
+        }
 
-        if (FD_ISSET(server_fd, &read_fds)) {
-            new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
-            printf("New connection, socket fd: %d\n", new_socket);
+        if (config_reload_requested) {
+            config_reload_requested = 0;
+            config_reload();
+        }
 
-            FD_SET(new_socket, &all_fds);
-            if (new_socket > max_fd) max_fd = new_socket;
+        // Hand-off happens between iterations, before this round's input is read
+        if (!draining && server_fd >= 0) upgrade_handle(&read_fds, server_fd);
+        migrate_handle(&read_fds);
+
+        if (migrate_drain_requested && !draining) {
+            // Stop taking players; the router drops a backend whose socket is gone
+            draining = 1;
+            printf("Draining: moving every game to %s.\n", migrate_drain_path);
+            if (server_fd >= 0) {
+                FD_CLR(server_fd, &all_fds);
+                close(server_fd);
+                server_fd = -1;
+            }
+            for (int i = 0; i < unix_count; i++) {
+                FD_CLR(unix_fds[i], &all_fds);
+                close(unix_fds[i]);
+                unlink(unix_paths[i]);
+            }
+            unix_count = 0;
+        }
+        if (draining && migrate_drain_step() == 0 && spectator_active() == 0) {
+            printf("Drained. Exiting.\n");
+            exit(EXIT_SUCCESS);
+        }
 
-            // Assign the new socket to an available player slot
-            for (int i = 0; i < MAX_PLAYERS; i++) {
-                if (players[i].sockfd == -1 && players[i].state != STATE_DISCONNECTED) {
-                    players[i].sockfd = new_socket;
-                    printf("Assigned new player to slot %d (fd: %d)\n", i, new_socket);
-                    break;
-                }
+        struct timespec work_start;
+        clock_gettime(CLOCK_MONOTONIC, &work_start);
+
+        if (server_fd >= 0 && FD_ISSET(server_fd, &read_fds)) {
+            accept_connection(server_fd);
+        }
+        for (int i = 0; i < unix_count; i++) {
+            if (FD_ISSET(unix_fds[i], &read_fds)) {
+                accept_connection(unix_fds[i]);
             }
         }
 
         // Handle existing player messages
         for (int i = 0; i < MAX_PLAYERS; i++) {
             if (players[i].sockfd != -1 && FD_ISSET(players[i].sockfd, &read_fds)) {
-                int valread = read(players[i].sockfd, players[i].buffer + players[i].bufferPtr,
-                                BUFFER_SIZE - players[i].bufferPtr);
-
-                if (valread <= 0) {  // Client disconnected or I/O error
-                    printf("Player %s disconnected.\n", players[i].username);
-                    close(players[i].sockfd);
-                    FD_CLR(players[i].sockfd, &all_fds);
-
-                    GameSession *session = find_session_by_username(players[i].username);
-                    if (session) {
-                        Player *opponent = (session->players[0] == &players[i]) ? session->players[1] : session->players[0];
-                        if (opponent && opponent->state == STATE_IDLE) {
-                            cleanup_session(session);
-                            continue;
-                        } else if (opponent->state == STATE_PLAYING) {
-                            if (send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 29, 0) == -1) {
-                                perror("Failed to notify opponent about disconnection");
-                            } else {
-                                printf("Notified opponent about player %s's disconnection.\n", players[i].username);
-                            }
-                        }
-                    }
-
-                    clear_player_data(&players[i]);
-
-                } else {
-                    players[i].bufferPtr += valread;
-                    players[i].buffer[players[i].bufferPtr] = '\0'; // Null-terminate buffer
-                    handle_player_message(&players[i]);
+                if (player_receive(&players[i]) <= 0) {  // Client disconnected or I/O error
+                    TRACE_HANDLER("connection_closed", NULL, &players[i], handle_connection_closed(&players[i]));
                 }
             }
         }
+        // Every move of this iteration has run; queue joins and heartbeats follow
+        scheduler_run();
+        handle_flagged_players();
+
+        bot_handle_io(&read_fds);
+        bot_tick();
+        spectator_handle_io(&read_fds, &write_fds);
+        admin_handle_io(&read_fds, &write_fds);
+        output_flush_all();
+
+        struct timespec work_end;
+        clock_gettime(CLOCK_MONOTONIC, &work_end);
+        long work_us = (work_end.tv_sec - work_start.tv_sec) * 1000000L +
+                       (work_end.tv_nsec - work_start.tv_nsec) / 1000;
+        admission_record_work(work_us);
+        admin_record_loop(work_us);
     }
 
     return 0;
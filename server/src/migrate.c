@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include "migrate.h"
+#include "snapshot.h"
+#include "upgrade.h"
+#include "network.h"
+#include "bot.h"
+#include "admission.h"
+#include "recorder.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Live migration of one game (or one player between games) to another server
+// process on the same machine. The sockets themselves move with SCM_RIGHTS,
+// so clients keep their connection and never notice; the receiving process
+// restores the players and session into free slots of its own tables.
+
+typedef struct {
+    uint32_t magic;
+    uint32_t fdCount;
+    uint32_t snapshotLen;
+    uint32_t reserved;
+    int64_t startNs;
+} MigrateHeader;
+
+const char *migrate_drain_path = NULL;
+volatile sig_atomic_t migrate_drain_requested = 0;
+
+static int migrate_fd = -1;
+static long long retry_after_ns = 0;
+
+int migrate_listen(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Migration socket path too long: %s\n", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    migrate_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (migrate_fd < 0) {
+        perror("Migration socket creation failed");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(migrate_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(migrate_fd, 4) < 0) {
+        perror("Migration socket bind failed");
+        close(migrate_fd);
+        migrate_fd = -1;
+        return -1;
+    }
+
+    FD_SET(migrate_fd, &all_fds);
+    if (migrate_fd > max_fd) max_fd = migrate_fd;
+    printf("Accepting migrated games on %s.\n", path);
+    return 0;
+}
+
+static int find_bot_seat(const Player *player) {
+    for (int seat = 0; seat < MAX_BOTS; seat++) {
+        Player *bot_player;
+        int peer_fd, joined, awaiting;
+        if (bot_seat_info(seat, &bot_player, &peer_fd, &joined, &awaiting) == 0 && bot_player == player) {
+            return seat;
+        }
+    }
+    return -1;
+}
+
+// Sends members (the session's players, or one player without a session) and
+// the session's watchers. On success every local trace of them is gone.
+static int transfer(Player **members, int count, GameSession *session, const char *path) {
+    long long start = monotonic_ns();
+    static int fds[MIGRATE_MAX_FDS];
+    static int watcher_fds[MAX_SPECTATORS];
+    int fd_count = 0;
+    int watcher_count = 0;
+    int bot_seats[2] = {-1, -1};
+    SnapWriter w = {0};
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Cannot reach the migration target");
+        if (conn >= 0) close(conn);
+        return -1;
+    }
+
+    snap_put_u32(&w, SNAPSHOT_VERSION);
+    snap_put_u32(&w, count);
+    for (int i = 0; i < count; i++) {
+        Player *player = members[i];
+        snapshot_put_player(&w, player, player->sockfd != -1 ? fd_count : -1);
+        if (player->sockfd != -1) fds[fd_count++] = player->sockfd;
+
+        bot_seats[i] = find_bot_seat(player);
+        snap_put_u32(&w, bot_seats[i] >= 0);
+        if (bot_seats[i] >= 0) {
+            Player *bot_player;
+            int peer_fd, joined, awaiting;
+            bot_seat_info(bot_seats[i], &bot_player, &peer_fd, &joined, &awaiting);
+            snap_put_u32(&w, fd_count);
+            snap_put_u32(&w, joined);
+            snap_put_u32(&w, awaiting);
+            fds[fd_count++] = peer_fd;
+        }
+    }
+
+    snap_put_u32(&w, session != NULL);
+    if (session) {
+        snapshot_put_session(&w, session, session->players[0] ? 0 : -1,
+                             session->players[1] ? (session->players[0] ? 1 : 0) : -1);
+
+        // Watchers with undelivered events stay behind, finish their queue and close
+        while (session->firstSpectator >= 0) {
+            int fd = spectator_detach(session->firstSpectator);
+            if (fd >= 0) watcher_fds[watcher_count++] = fd;
+        }
+        snap_put_u32(&w, watcher_count);
+        for (int i = 0; i < watcher_count; i++) {
+            snap_put_u32(&w, fd_count);
+            fds[fd_count++] = watcher_fds[i];
+        }
+    }
+
+    MigrateHeader header = {MIGRATE_MAGIC, fd_count, (uint32_t)w.len, 0, start};
+    struct timeval timeout = {0, MIGRATE_ACK_TIMEOUT_MS * 1000};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char ack = 0;
+    int ok = !w.failed && write_full(conn, &header, sizeof(header)) == 0 && send_fds(conn, fds, fd_count) == 0 &&
+             write_full(conn, w.data, w.len) == 0 && read_full(conn, &ack, 1) == 0 && ack == 'K';
+    snap_free(&w);
+    close(conn);
+
+    if (!ok) {
+        // The target refused or went quiet; the game carries on here
+        for (int i = 0; i < watcher_count; i++) {
+            if (spectator_adopt(watcher_fds[i], session) < 0) close(watcher_fds[i]);
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        Player *player = members[i];
+        if (bot_seats[i] >= 0) {
+            Player *bot_player;
+            int peer_fd, joined, awaiting;
+            bot_seat_info(bot_seats[i], &bot_player, &peer_fd, &joined, &awaiting);
+            bot_detach(bot_seats[i]);
+            close(peer_fd);
+        }
+        if (player->sockfd != -1) {
+            admission_release(player->sockfd);
+            FD_CLR(player->sockfd, &all_fds);
+            close(player->sockfd);
+        }
+        clear_player_data(player);
+    }
+    if (session) cleanup_session(session);
+    for (int i = 0; i < watcher_count; i++) {
+        close(watcher_fds[i]);
+    }
+
+    printf("Migrated %d players and %d watchers to %s. Pause: %.2f ms.\n",
+           count, watcher_count, path, (monotonic_ns() - start) / 1e6);
+    return 0;
+}
+
+int migrate_session(GameSession *session, const char *path) {
+    Player *members[2];
+    int count = 0;
+    for (int i = 0; i < 2; i++) {
+        if (session->players[i]) members[count++] = session->players[i];
+    }
+    if (count == 0) return -1;
+    return transfer(members, count, session, path);
+}
+
+int migrate_player(Player *player, const char *path) {
+    if (find_session_by_username(player->username)) return -1;
+    return transfer(&player, 1, NULL, path);
+}
+
+static int free_player_slot(int skip_a, int skip_b) {
+    int limit = config()->maxPlayers;
+    for (int i = 0; i < limit; i++) {
+        if (i == skip_a || i == skip_b) continue;
+        if (players[i].sockfd == -1 && players[i].state != STATE_DISCONNECTED) return i;
+    }
+    return -1;
+}
+
+static int name_in_use(const char *username) {
+    if (!username[0]) return 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if ((players[i].sockfd != -1 || players[i].state != STATE_IDLE) &&
+            strcmp(players[i].username, username) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void receive(int conn) {
+    static int fds[MIGRATE_MAX_FDS];
+    static Player incoming[2];
+    static GameSession incoming_session;
+    static int watcher_index[MAX_SPECTATORS];
+    int fd_index[2] = {-1, -1};
+    int bot[2] = {0, 0};
+    int peer_index[2], joined[2], awaiting[2];
+    int slots[2] = {-1, -1};
+    int session_slots[2];
+    uint32_t watcher_count = 0;
+    int fd_count = 0;
+    char *data = NULL;
+    GameSession *session = NULL;
+
+    MigrateHeader header;
+    if (read_full(conn, &header, sizeof(header)) < 0 || header.magic != MIGRATE_MAGIC ||
+        header.fdCount > MIGRATE_MAX_FDS) {
+        printf("Bad migration header.\n");
+        return;
+    }
+    if (recv_fds(conn, fds, header.fdCount) < 0) return;
+    fd_count = header.fdCount;
+
+    data = malloc(header.snapshotLen);
+    if (!data || read_full(conn, data, header.snapshotLen) < 0) goto refuse;
+
+    SnapReader r = {data, header.snapshotLen, 0, 0};
+    uint32_t count = 0;
+    if (snap_get_u32(&r) != SNAPSHOT_VERSION || (count = snap_get_u32(&r)) < 1 || count > 2) goto refuse;
+
+    for (uint32_t i = 0; i < count; i++) {
+        snapshot_get_player(&r, &incoming[i], &fd_index[i]);
+        bot[i] = (int)snap_get_u32(&r);
+        if (bot[i]) {
+            peer_index[i] = (int)snap_get_u32(&r);
+            joined[i] = (int)snap_get_u32(&r);
+            awaiting[i] = (int)snap_get_u32(&r);
+            if (peer_index[i] < 0 || peer_index[i] >= fd_count) goto refuse;
+        }
+        if (fd_index[i] >= fd_count) goto refuse;
+        if (name_in_use(incoming[i].username)) {
+            printf("Player %s already exists here. Refusing migration.\n", incoming[i].username);
+            goto refuse;
+        }
+    }
+
+    int has_session = (int)snap_get_u32(&r);
+    if (has_session) {
+        snapshot_get_session(&r, &incoming_session, &session_slots[0], &session_slots[1]);
+        watcher_count = snap_get_u32(&r);
+        if (watcher_count > MAX_SPECTATORS) goto refuse;
+        for (uint32_t i = 0; i < watcher_count; i++) {
+            watcher_index[i] = (int)snap_get_u32(&r);
+            if (watcher_index[i] < 0 || watcher_index[i] >= fd_count) goto refuse;
+        }
+    }
+    if (r.failed) goto refuse;
+
+    // Both checked the way a local game would be: within max-players and max-sessions
+    slots[0] = free_player_slot(-1, -1);
+    if (count == 2) slots[1] = free_player_slot(slots[0], -1);
+    if (slots[0] >= 0 && (count == 1 || slots[1] >= 0) && has_session) session = allocate_session();
+    if (slots[0] < 0 || (count == 2 && slots[1] < 0) || (has_session && !session)) {
+        printf("No room for a migrated game.\n");
+        goto refuse;
+    }
+
+    // Once the sender reads this it drops its copies, so everything below must succeed
+    if (write_full(conn, "K", 1) < 0) goto refuse;
+    free(data);
+
+    for (uint32_t i = 0; i < count; i++) {
+        Player *player = &players[slots[i]];
+        *player = incoming[i];
+        // The leased receive buffer moves with the player; the staging copy
+        // would otherwise release it on the next migration
+        incoming[i].buffer = NULL;
+        incoming[i].bufferPtr = 0;
+        player->sockfd = -1;
+        if (fd_index[i] >= 0) {
+            player->sockfd = fds[fd_index[i]];
+            register_inherited_fd(player->sockfd);
+        }
+        player_requeue_held(player);
+    }
+
+    if (session) {
+        int first = session->firstSpectator;
+        int watchers = session->spectatorCount;
+        *session = incoming_session;
+        session->firstSpectator = first;
+        session->spectatorCount = watchers;
+        for (int i = 0; i < 2; i++) {
+            int index = session_slots[i];
+            session->players[i] = (index >= 0 && index < (int)count) ? &players[slots[index]] : NULL;
+        }
+        recorder_reset(session);
+        recorder_note(session, NULL, "moved in from another server");
+        for (uint32_t i = 0; i < watcher_count; i++) {
+            int fd = fds[watcher_index[i]];
+            if (spectator_adopt(fd, session) < 0) {
+                close(fd);
+            } else {
+                register_inherited_fd(fd);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (bot[i] && bot_adopt(&players[slots[i]], fds[peer_index[i]], joined[i], awaiting[i]) < 0) {
+            printf("Bots are disabled here. Ending the bot's game.\n");
+            close(fds[peer_index[i]]);
+            disconnect_player(&players[slots[i]]);
+        }
+    }
+
+    // A waiting player may find its opponent here straight away
+    if (!session && players[slots[0]].state == STATE_WAITING) {
+        match_waiting_player(&players[slots[0]]);
+    }
+
+    printf("Received %s%s%s from another server with %u watchers. Pause: %.2f ms.\n",
+           players[slots[0]].username, count == 2 ? " vs " : "", count == 2 ? players[slots[1]].username : "",
+           watcher_count, (monotonic_ns() - header.startNs) / 1e6);
+    return;
+
+refuse:
+    // The slot counts as taken once allocated but is still empty
+    if (session) session_count--;
+    free(data);
+    for (int i = 0; i < fd_count; i++) {
+        close(fds[i]);
+    }
+    write_full(conn, "N", 1);
+}
+
+void migrate_handle(fd_set *read_fds) {
+    if (migrate_fd < 0 || !FD_ISSET(migrate_fd, read_fds)) return;
+
+    int conn = accept(migrate_fd, NULL, NULL);
+    if (conn < 0) {
+        perror("Migration accept failed");
+        return;
+    }
+
+    struct timeval timeout = {0, MIGRATE_ACK_TIMEOUT_MS * 1000};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    receive(conn);
+    close(conn);
+}
+
+int migrate_drain_step() {
+    // One unit per loop iteration, so games still waiting their turn keep running
+    int remaining = 0;
+    GameSession *next_session = NULL;
+    Player *next_player = NULL;
+
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].players[0] || sessions[i].players[1]) {
+            remaining++;
+            if (!next_session) next_session = &sessions[i];
+        }
+    }
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        // Bots left waiting alone are released once their human is gone
+        if (players[i].sockfd == -1 || is_bot_player(&players[i]) ||
+            find_session_by_username(players[i].username)) {
+            continue;
+        }
+        remaining++;
+        if (!next_player) next_player = &players[i];
+    }
+
+    if (remaining == 0 || monotonic_ns() < retry_after_ns) return remaining;
+
+    int result = next_session ? migrate_session(next_session, migrate_drain_path)
+                              : migrate_player(next_player, migrate_drain_path);
+    if (result < 0) {
+        printf("Migration to %s failed. Retrying in a second.\n", migrate_drain_path);
+        retry_after_ns = monotonic_ns() + 1000000000LL;
+        return remaining;
+    }
+    return remaining - 1;
+}
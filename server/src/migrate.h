@@ -0,0 +1,22 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include "game.h"
+#include "spectator.h"
+#include <signal.h>
+#include <sys/select.h>
+
+#define MIGRATE_MAGIC 0x474D564B   // "KVMG"
+#define MIGRATE_ACK_TIMEOUT_MS 1000
+#define MIGRATE_MAX_FDS (4 + MAX_SPECTATORS)  // Two players, a bot peer and every watcher
+
+extern const char *migrate_drain_path;            // Server that takes over when draining
+extern volatile sig_atomic_t migrate_drain_requested;
+
+int migrate_listen(const char *path);
+void migrate_handle(fd_set *read_fds);
+int migrate_session(GameSession *session, const char *path);
+int migrate_player(Player *player, const char *path);
+int migrate_drain_step();
+
+#endif
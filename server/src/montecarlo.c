@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+#include "montecarlo.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Replace everything the deciding player cannot see (opponent hand and draw
+// pile order) with a random arrangement of the same unseen cards.
+static void determinize(CompactGame *game, int seat, RulesRng *rng) {
+    uint8_t unseen[RULES_DECK_SIZE];
+    int opponent = seat ^ 1;
+    int count = 0;
+
+    memcpy(unseen, game->hand[opponent], game->handSize[opponent]);
+    count += game->handSize[opponent];
+    memcpy(unseen + count, game->drawPile, game->drawTop + 1);
+    count += game->drawTop + 1;
+
+    for (int i = count - 1; i > 0; i--) {
+        int j = rules_rng_below(rng, i + 1);
+        uint8_t temp = unseen[i];
+        unseen[i] = unseen[j];
+        unseen[j] = temp;
+    }
+
+    memcpy(game->hand[opponent], unseen, game->handSize[opponent]);
+    memcpy(game->drawPile, unseen + game->handSize[opponent], game->drawTop + 1);
+}
+
+int mc_choose_move(const CompactGame *game, uint64_t seed, int budget_ms, int max_rollouts,
+                   Move *best, MonteCarloStats *stats) {
+    Move moves[RULES_MAX_MOVES];
+    int visits[RULES_MAX_MOVES] = {0};
+    double wins[RULES_MAX_MOVES] = {0};
+    int count = rules_legal_moves(game, moves);
+    int seat = game->currentTurn;
+    double start = now_ms();
+    int total = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->candidates = count;
+    if (count == 0) return -1;
+
+    *best = moves[0];
+    if (count == 1) return 0;
+
+    RulesRng rng;
+    rules_rng_seed(&rng, seed);
+
+    while (total < max_rollouts) {
+        // Check the clock in batches so timing stays off the rollout path
+        if ((total & 31) == 0 && total > 0 && now_ms() - start >= budget_ms) break;
+
+        // UCB1 over the root moves, every move is tried once first
+        int pick = -1;
+        double best_score = -1.0;
+        for (int i = 0; i < count; i++) {
+            if (visits[i] == 0) {
+                pick = i;
+                break;
+            }
+            double score = wins[i] / visits[i] + 1.4 * sqrt(log((double)total) / visits[i]);
+            if (score > best_score) {
+                best_score = score;
+                pick = i;
+            }
+        }
+
+        CompactGame sim = *game;
+        determinize(&sim, seat, &rng);
+        rules_apply(&sim, &moves[pick]);
+        int winner = rules_playout(&sim, &rng, sim.plies + MC_MAX_PLIES);
+
+        visits[pick]++;
+        wins[pick] += (winner == seat) ? 1.0 : (winner == RULES_NO_WINNER ? 0.5 : 0.0);
+        total++;
+    }
+
+    int chosen = 0;
+    for (int i = 1; i < count; i++) {
+        if (visits[i] > visits[chosen]) chosen = i;
+    }
+
+    *best = moves[chosen];
+    stats->rollouts = total;
+    stats->elapsedMs = now_ms() - start;
+    stats->winRate = visits[chosen] ? wins[chosen] / visits[chosen] : 0.0;
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+
+#include "rules.h"
+
+#define MC_MAX_PLIES 400  // Rollouts longer than this count as a draw
+
+typedef struct {
+    int rollouts;
+    int candidates;
+    double elapsedMs;
+    double winRate;      // Estimated win rate of the chosen move
+} MonteCarloStats;
+
+int mc_choose_move(const CompactGame *game, uint64_t seed, int budget_ms, int max_rollouts,
+                   Move *best, MonteCarloStats *stats);
+
+#endif
@@ -2,4 +2,5 @@
 #define NETWORK_H
 #include <sys/select.h>
 extern fd_set all_fds; // Declare it as extern
+extern int max_fd;
 #endif
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "output.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// A move fans out into several small messages to both players. Depending on
+// output-coalesce they leave one by one, are gathered into one write per
+// socket, or are held back by TCP_CORK, until the event loop finishes the
+// iteration. coalesce-max-us bounds how long a message may wait.
+
+OutputStats output_stats;
+
+static PendingOutput pending[FD_SETSIZE];
+static int dirty_fds[FD_SETSIZE];
+static int dirty_count = 0;
+static long long tick_start_ns = 0;  // First held message of this tick
+static pthread_t loop_thread;
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long coarse_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void output_init() {
+    loop_thread = pthread_self();
+}
+
+static void write_pending(int fd) {
+    PendingOutput *out = &pending[fd];
+    if (out->len > 0) {
+        if (send(fd, out->data, out->len, MSG_NOSIGNAL) == -1 && errno != EPIPE && errno != ECONNRESET) {
+            perror("Failed to flush output");
+        }
+        output_stats.writes++;
+        out->len = 0;
+    }
+    if (out->corked) {
+        int off = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        out->corked = 0;
+    }
+}
+
+static void mark_dirty(int fd) {
+    if (!pending[fd].dirty) {
+        pending[fd].dirty = 1;
+        dirty_fds[dirty_count++] = fd;
+        if (dirty_count == 1) tick_start_ns = monotonic_ns();
+    }
+}
+
+ssize_t output_send(int fd, const void *data, size_t len) {
+    output_stats.messages++;
+    int mode = config()->outputCoalesce;
+    if (fd >= 0 && fd < FD_SETSIZE) pending[fd].sentMs = coarse_ms();
+
+    // The heartbeat thread must not touch the loop's buffers
+    if (fd < 0 || fd >= FD_SETSIZE || mode == OUTPUT_DIRECT || !pthread_equal(pthread_self(), loop_thread)) {
+        if (fd >= 0 && fd < FD_SETSIZE && pending[fd].len > 0 && pthread_equal(pthread_self(), loop_thread)) {
+            write_pending(fd);
+        }
+        output_stats.writes++;
+        return send(fd, data, len, MSG_NOSIGNAL);
+    }
+
+    // Past the latency bound the tick is flushed early
+    int max_us = config()->coalesceMaxUs;
+    if (dirty_count > 0 && monotonic_ns() - tick_start_ns > max_us * 1000LL) {
+        output_stats.boundFlushes++;
+        output_flush_all();
+    }
+
+    PendingOutput *out = &pending[fd];
+    if (mode == OUTPUT_CORK) {
+        if (!out->corked && !out->notTcp) {
+            int on = 1;
+            if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == 0) {
+                out->corked = 1;
+                mark_dirty(fd);
+            } else {
+                out->notTcp = 1;
+            }
+        }
+        output_stats.writes++;
+        return send(fd, data, len, MSG_NOSIGNAL);
+    }
+
+    if (out->len + len > OUTPUT_BUFFER) {
+        write_pending(fd);
+        if (len > OUTPUT_BUFFER) {
+            output_stats.writes++;
+            return send(fd, data, len, MSG_NOSIGNAL);
+        }
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    mark_dirty(fd);
+    return len;
+}
+
+// Before a descriptor is closed or handed over; its number may be reused
+void output_release(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE || !pthread_equal(pthread_self(), loop_thread)) return;
+    write_pending(fd);
+    pending[fd].notTcp = 0;
+    pending[fd].sentMs = 0;
+}
+
+long long output_last_sent_ms(int fd) {
+    return (fd >= 0 && fd < FD_SETSIZE) ? pending[fd].sentMs : 0;
+}
+
+void output_flush_all() {
+    for (int i = 0; i < dirty_count; i++) {
+        int fd = dirty_fds[i];
+        write_pending(fd);
+        pending[fd].dirty = 0;
+    }
+    dirty_count = 0;
+}
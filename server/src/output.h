@@ -0,0 +1,40 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#define OUTPUT_BUFFER 4096  // Bytes held per descriptor until the end of the tick
+
+typedef enum {
+    OUTPUT_DIRECT,  // Every message is its own send()
+    OUTPUT_GATHER,  // Messages are copied and written once per socket per tick
+    OUTPUT_CORK     // Messages are sent at once, TCP_CORK holds them until the tick ends
+} OutputMode;
+
+typedef struct {
+    int len;
+    char corked;     // TCP_CORK is set for this tick
+    char notTcp;     // Cork failed once, a socketpair or Unix socket
+    char dirty;      // Listed in dirty_fds until the tick is flushed
+    long long sentMs; // Last message for this descriptor, 0 = none since it was opened
+    char data[OUTPUT_BUFFER];
+} PendingOutput;
+
+typedef struct {
+    unsigned long messages;
+    unsigned long writes;       // send() calls that carried messages
+    unsigned long boundFlushes; // Ticks cut short by coalesce-max-us
+} OutputStats;
+
+extern OutputStats output_stats;
+
+void output_init();
+ssize_t output_send(int fd, const void *data, size_t len);
+void output_release(int fd);
+// When a message for fd was last sent or queued, in CLOCK_MONOTONIC_COARSE ms
+long long output_last_sent_ms(int fd);
+void output_flush_all();
+
+#endif
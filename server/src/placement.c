@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include "game.h"
+#include "player.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// There is no libnuma here: memory lands on the node of the CPU that first
+// writes it, so pinning the event loop before pre-faulting is what makes the
+// pools node-local. Bot workers allocate their own rollout state after
+// being pinned, which keeps theirs local too.
+
+int placement_pin(pthread_t thread, int cpu, const char *name) {
+    if (cpu < 0) return 0;
+
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpu >= cpus) {
+        fprintf(stderr, "Cannot pin %s to CPU %d, there are %ld CPUs.\n", name, cpu, cpus);
+        return -1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "Failed to pin %s to CPU %d: %s\n", name, cpu, strerror(err));
+        return -1;
+    }
+    printf("Pinned %s to CPU %d.\n", name, cpu);
+    return 0;
+}
+
+// Only the huge pages lying entirely inside the array can be advised
+static void advise_huge(void *start, size_t size) {
+    uintptr_t first = ((uintptr_t)start + PLACEMENT_HUGE_PAGE - 1) & ~(PLACEMENT_HUGE_PAGE - 1);
+    uintptr_t last = ((uintptr_t)start + size) & ~(PLACEMENT_HUGE_PAGE - 1);
+    if (last <= first) return;
+
+    if (madvise((void *)first, last - first, MADV_HUGEPAGE) < 0) {
+        perror("madvise(MADV_HUGEPAGE) failed");
+    }
+}
+
+// A write per page makes the kernel back it now rather than mid-game
+static void prefault(void *start, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char *bytes = start;
+    for (size_t offset = 0; offset < size; offset += page) {
+        bytes[offset] = bytes[offset];
+    }
+}
+
+static long anon_huge_kb() {
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) return -1;
+
+    char line[128];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+    }
+    fclose(file);
+    return kb;
+}
+
+int placement_setup() {
+    const Config *settings = config();
+    if (placement_pin(pthread_self(), settings->loopCpu, "event loop") < 0) return -1;
+    if (!settings->hugePages && !settings->prefault) return 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (settings->hugePages) {
+        advise_huge(players, sizeof(players));
+        advise_huge(sessions, sizeof(sessions));
+    }
+    if (settings->prefault) {
+        prefault(players, sizeof(players));
+        prefault(sessions, sizeof(sessions));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Player and session pools: %zu MB%s%s in %.1f ms, %ld MB on huge pages.\n",
+           (sizeof(players) + sizeof(sessions)) >> 20,
+           settings->hugePages ? ", huge pages advised" : "",
+           settings->prefault ? ", pre-faulted" : "",
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+           anon_huge_kb() >> 10);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <pthread.h>
+
+#define PLACEMENT_HUGE_PAGE (2UL * 1024 * 1024)
+
+// Pins the calling thread to loop-cpu, then advises huge pages for and
+// pre-faults players[] and sessions[] so first touch puts them on that CPU's
+// NUMA node. Call before anything else writes to the pools.
+int placement_setup();
+// cpu < 0 leaves the thread unpinned
+int placement_pin(pthread_t thread, int cpu, const char *name);
+
+#endif
@@ -1,15 +1,67 @@
 #include "player.h"
 #include "game.h"
 #include "network.h"
+#include "spectator.h"
+#include "admission.h"
+#include "recorder.h"
+#include "profile.h"
+#include "config.h"
+#include "output.h"
+#include "scheduler.h"
+#include "trace.h"
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
 Player players[MAX_PLAYERS];
 
+// Reads go into one scratch buffer; only the event loop reads player sockets.
+// Almost every read is one whole short command, so a connection leases a
+// buffer of its own only when a message is cut in two, and returns it once
+// the rest has come. Returned buffers stay in the pool.
+typedef union ReceiveBuffer {
+    union ReceiveBuffer *next;
+    char data[BUFFER_SIZE];
+} ReceiveBuffer;
+
+static char receive_scratch[BUFFER_SIZE];
+static ReceiveBuffer *receive_pool;
+// The activity checker may clear a player from its own thread
+static pthread_mutex_t receive_lock = PTHREAD_MUTEX_INITIALIZER;
+ReceiveStats receive_stats;
+
+static char *lease_buffer() {
+    pthread_mutex_lock(&receive_lock);
+    ReceiveBuffer *buffer = receive_pool;
+    if (buffer) {
+        receive_pool = buffer->next;
+        receive_stats.pooled--;
+    } else {
+        buffer = malloc(sizeof(ReceiveBuffer));
+    }
+    if (buffer) receive_stats.leased++;
+    pthread_mutex_unlock(&receive_lock);
+    return buffer ? buffer->data : NULL;
+}
+
+static void release_buffer(Player *player) {
+    if (!player->buffer) return;
+    ReceiveBuffer *buffer = (ReceiveBuffer *)player->buffer;
+    player->buffer = NULL;
+    player->bufferPtr = 0;
+    pthread_mutex_lock(&receive_lock);
+    buffer->next = receive_pool;
+    receive_pool = buffer;
+    receive_stats.pooled++;
+    receive_stats.leased--;
+    pthread_mutex_unlock(&receive_lock);
+}
+
 void init_players() {
     for (int i = 0; i < MAX_PLAYERS; i++) {
         clear_player_data(&players[i]);
@@ -28,11 +80,24 @@ void clear_player_data(Player *player) {
 
     player->missedHeartbeats = 0;
 
-    memset(player->buffer, 0, BUFFER_SIZE);
-    player->bufferPtr = 0;
+    release_buffer(player);
     player->pendingHeartbeat = 0;
+    player->lastSeenMs = 0;
 
     memset(player->username, 0, BUFFER_SIZE);
+    player->queueTime = 0;
+    player->tokens = 0;
+    player->lastRefillMs = 0;
+    player->throttled = 0;
+    player->rating = 0;
+    player->probeSentUs = 0;
+    player->probeHeartbeat = 0;
+    player->rttUs = 0;
+    player->rttVarUs = 0;
+    player->expired = 0;
+    atomic_store(&player->heartbeatSentUs, 0);
+    atomic_store(&player->missedNotice, 0);
+    scheduler_done(player);
 }
 
 void disconnect_player(Player *player) {
@@ -44,17 +109,21 @@ void disconnect_player(Player *player) {
     // Notify the opponent and handle session cleanup if necessary
     GameSession *session = find_session_by_username(player->username);
     if (session) {
+        recorder_note(session, player, "disconnect");
         Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
         
         if (opponent) {
             if (opponent->sockfd != -1) {
                 // Opponent is still connected; notify them
-                if (send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 29, MSG_NOSIGNAL) == -1) {
+                recorder_sent(session, opponent, "KIVUPSOPPONENT_DISCONNECTED\n");
+                if (output_send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 28) == -1) {
                     perror("Failed to notify opponent about disconnection");
                 } else {
                     printf("Notified opponent %s about player %s's disconnection.\n", 
                            opponent->username, player->username);
                 }
+                // The slot is cleared below and may be taken by a new connection
+                session->players[session->players[1] == player] = NULL;
             } else {
                 // Opponent is already disconnected; clear the session
                 printf("Opponent %s is already disconnected. Clearing session.\n", opponent->username);
@@ -68,6 +137,8 @@ void disconnect_player(Player *player) {
     }
 
     // Disconnect the player
+    admission_release(player->sockfd);
+    output_release(player->sockfd);
     close(player->sockfd);
     FD_CLR(player->sockfd, &all_fds);
     clear_player_data(player);
@@ -75,79 +146,267 @@ void disconnect_player(Player *player) {
     printf("Player %s disconnected and cleared.\n", player->username);
 }
 
-void handle_player_message(Player *player) {
-    char *buffer = player->buffer;
-    int buffer_size = player->bufferPtr;
+void handle_connection_closed(Player *player) {
+    printf("Player %s disconnected.\n", player->username);
+    admission_release(player->sockfd);
+    output_release(player->sockfd);
+    close(player->sockfd);
+    FD_CLR(player->sockfd, &all_fds);
 
-    char *message_start = buffer;
-    char *newline;
+    GameSession *session = find_session_by_username(player->username);
+    if (session) {
+        recorder_note(session, player, "connection closed");
+        Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
+        // Fall through to clear_player_data so the slot never keeps a closed fd
+        if (!opponent || opponent->state == STATE_IDLE) {
+            cleanup_session(session);
+        } else {
+            if (opponent->state == STATE_PLAYING) {
+                recorder_sent(session, opponent, "KIVUPSOPPONENT_DISCONNECTED\n");
+                if (output_send(opponent->sockfd, "KIVUPSOPPONENT_DISCONNECTED\n", 28) == -1) {
+                    perror("Failed to notify opponent about disconnection");
+                } else {
+                    printf("Notified opponent about player %s's disconnection.\n", player->username);
+                }
+            }
+            // The cleared slot may be reused, so it must not stay seated here
+            session->players[session->players[1] == player] = NULL;
+        }
+    }
 
-    while ((newline = memchr(message_start, '\n', buffer_size - (message_start - buffer))) != NULL) {
-        *newline = '\0';  // Safely null-terminate
+    clear_player_data(player);
+}
+
+static void protocol_violation(Player *player, const char *reason) {
+    printf("%s. Disconnecting player %s.\n", reason, player->username);
+
+    // Keep what led up to it while the session still exists
+    GameSession *session = player->username[0] ? find_session_by_username(player->username) : NULL;
+    if (session) {
+        recorder_note(session, player, "%s", reason);
+        recorder_dump(session, reason, NULL, 0);
+    }
+    disconnect_player(player);
+}
 
-        // Validate message prefix
-        if (strncmp(message_start, "KIVUPS", 6) != 0) {
-            printf("Invalid packet. Disconnecting player.\n");
+static int run_opcode(Player *player, const char *opcode, char *message);
+
+// Runs one NUL-terminated command; returns 0 when the connection was dropped or left players[]
+static int dispatch_command(Player *player, char *message) {
+    // Validate message prefix
+    if (strncmp(message, "KIVUPS", 6) != 0) {
+        protocol_violation(player, "Invalid packet");
+        return 0;
+    }
+
+    // Drop commands over the connection's rate, cut connections that never slow down.
+    // Moves in a game are not limited: the client waits on the answer to each, so a
+    // dropped one would stall the game
+    int in_game_move = player->state == STATE_PLAYING &&
+                       scheduler_classify(message, strlen(message)) == CLASS_MOVE;
+    if (!in_game_move && !admission_allow_command(player)) {
+        if (player->throttled >= ADMISSION_MAX_THROTTLED) {
+            printf("Player %s keeps exceeding the command rate. Disconnecting.\n", player->username);
+            admission_stats.rateDisconnects++;
             disconnect_player(player);
-            return;
+            return 0;
         }
+        return 1;
+    }
 
-        // Extract opcode and process it
-        char opcode[8];
-        strncpy(opcode, message_start + 6, 6);
-        opcode[6] = '\0';
+    // Extract opcode and process it
+    char opcode[8];
+    strncpy(opcode, message + 6, 6);
+    opcode[6] = '\0';
 
-        if (strcmp(opcode, "enterQ") == 0) {
-            if (player->state == STATE_IDLE) {
-                handle_enter_queue(player);
-            } else {
-                disconnect_player(player);
-            }
-        } else if (strcmp(opcode, "heartB") == 0) {
-            player->pendingHeartbeat = 0;
-        } else if (player->state == STATE_PLAYING) {
-            GameSession *session = find_session_by_username(player->username);
-            if (!session) {
-                disconnect_player(player);
-                return;
-            }
-            if (session->players[session->currentTurn] != player) {
-                disconnect_player(player);
-                return;
-            }
+    TRACE3(command_start, trace_player(player), (const char *)opcode, (int)player->state);
+    int kept = run_opcode(player, opcode, message);
+    TRACE3(command_done, trace_player(player), (const char *)opcode, kept);
+    return kept;
+}
 
-            if (strcmp(opcode, "playCa") == 0) {
-                handle_play_card(player);
-            } else if (strcmp(opcode, "suitCh") == 0) {
-                handle_suit_change(player);
-            } else if (strcmp(opcode, "drawCa") == 0) {
-                handle_draw_card(player, 0);
-            } else if (strcmp(opcode, "skipMv") == 0) {
-                handle_skip_opponent(player);
-            } else if (strcmp(opcode, "forceD") == 0) {
-                handle_force_draw(player);
-            } else {
-                disconnect_player(player);
-            }
+static int run_opcode(Player *player, const char *opcode, char *message) {
+    if (strcmp(opcode, "enterQ") == 0) {
+        if (player->state == STATE_IDLE) {
+            TRACE_HANDLER("enter_queue", NULL, player, handle_enter_queue(player, message));
         } else {
-            printf("Unhandled opcode: %s. Disconnecting player.\n", opcode);
+            protocol_violation(player, "enterQ while queued or playing");
+            return 0;
+        }
+    } else if (strcmp(opcode, "watchG") == 0 && player->state == STATE_IDLE) {
+        // On success the connection leaves players[] and the rest of the buffer goes with it
+        int moved;
+        TRACE_HANDLER("watch_game", NULL, player, moved = handle_watch_game(player, message));
+        if (moved) return 0;
+    } else if (strcmp(opcode, "heartB") == 0) {
+        // Nothing left to do, note_player_alive() already took the reply
+    } else if (player->state == STATE_PLAYING) {
+        GameSession *session = find_session_by_username(player->username);
+        if (!session) {
             disconnect_player(player);
+            return 0;
+        }
+        recorder_command(session, player, message);
+        if (session->players[session->currentTurn] != player) {
+            protocol_violation(player, "Move out of turn");
+            return 0;
+        }
+
+        if (strcmp(opcode, "playCa") == 0) {
+            TRACE_HANDLER("play_card", session, player, handle_play_card(player, message));
+        } else if (strcmp(opcode, "suitCh") == 0) {
+            TRACE_HANDLER("suit_change", session, player, handle_suit_change(player, message));
+        } else if (strcmp(opcode, "drawCa") == 0) {
+            TRACE_HANDLER("draw_card", session, player, handle_draw_card(player, 0));
+        } else if (strcmp(opcode, "skipMv") == 0) {
+            TRACE_HANDLER("skip_opponent", session, player, handle_skip_opponent(player));
+        } else if (strcmp(opcode, "forceD") == 0) {
+            TRACE_HANDLER("force_draw", session, player, handle_force_draw(player));
+        } else {
+            protocol_violation(player, "Unknown game opcode");
+            return 0;
+        }
+
+        // A game that ended with this move has no players left to check
+        if (session->players[0] && session->players[1]) {
+            recorder_check(session);
         }
+    } else {
+        printf("Unhandled opcode: %s.\n", opcode);
+        protocol_violation(player, "Unhandled opcode");
+        return 0;
+    }
+    return 1;
+}
 
+// Moves run as they are read. Any other command waits for the scheduler,
+// and so does everything behind it on the same connection.
+static void handle_messages(Player *player, char *buffer, int buffer_size) {
+    int sockfd = player->sockfd;
+    char *message_start = buffer;
+    char *newline;
+
+    // A handler that frees the slot ends the connection's turn
+    while (player->sockfd == sockfd && player->waitingClass == CLASS_MOVE &&
+           (newline = memchr(message_start, '\n', buffer_size - (message_start - buffer))) != NULL) {
+        CommandClass class = scheduler_classify(message_start, newline - message_start);
+        if (class != CLASS_MOVE) {
+            scheduler_queue(player, class);
+            break;
+        }
+
+        *newline = '\0';  // Safely null-terminate
+        scheduler_stats.run[class]++;
+        if (!dispatch_command(player, message_start)) return;
         message_start = newline + 1;
     }
 
-    // Shift incomplete message to the start of the buffer
+    if (player->sockfd != sockfd) return;
+
+    // Keep an incomplete message until the rest arrives, and a held one until its turn
     int remaining = buffer_size - (message_start - buffer);
-    if (remaining > 0) {
-        memmove(buffer, message_start, remaining);
+    if (player->waitingClass == CLASS_MOVE && remaining >= BUFFER_SIZE - 1) {
+        protocol_violation(player, "Message too long");
+        return;
+    }
+    player_keep_partial(player, message_start, remaining);
+}
+
+// A queued connection gets more input only behind what already waits
+static void append_pending(Player *player, const char *data, int len) {
+    int room = BUFFER_SIZE - 1 - player->bufferPtr;
+    if (len > room) len = room;
+    memcpy(player->buffer + player->bufferPtr, data, len);
+    player->bufferPtr += len;
+    player->buffer[player->bufferPtr] = '\0';
+}
+
+int player_receive(Player *player) {
+    if (player->waitingClass != CLASS_MOVE) {
+        int room = BUFFER_SIZE - 1 - player->bufferPtr;
+        // Full: the kernel holds the rest until the scheduler gets here
+        if (room == 0) return 1;
+        int valread = read(player->sockfd, player->buffer + player->bufferPtr, room);
+        if (valread > 0) {
+            note_player_alive(player);
+            player->bufferPtr += valread;
+            player->buffer[player->bufferPtr] = '\0';
+        }
+        return valread;
     }
 
-    player->bufferPtr = remaining;  // Update buffer pointer
+    // What was held goes first so the message is whole again
+    int held = player->bufferPtr;
+    if (held > 0) memcpy(receive_scratch, player->buffer, held);
+
+    // No more than a receive buffer holds, so whatever the scheduler keeps back fits one
+    int valread = read(player->sockfd, receive_scratch + held, BUFFER_SIZE - 1 - held);
+    if (valread > 0) {
+        note_player_alive(player);
+        handle_messages(player, receive_scratch, held + valread);
+    }
+    return valread;
+}
+
+void handle_player_message(Player *player, const char *data, int len) {
+    note_player_alive(player);
+    if (player->waitingClass != CLASS_MOVE) {
+        append_pending(player, data, len);
+        return;
+    }
+
+    int held = player->bufferPtr;
+    if (held > 0) memcpy(receive_scratch, player->buffer, held);
+    if (len > BUFFER_SIZE - 1 - held) len = BUFFER_SIZE - 1 - held;
+    memcpy(receive_scratch + held, data, len);
+    handle_messages(player, receive_scratch, held + len);
+}
+
+void player_run_pending(Player *player, int run) {
+    scheduler_done(player);
+    int held = player->bufferPtr;
+    if (held == 0) return;
+    memcpy(receive_scratch, player->buffer, held);
+    char *newline = memchr(receive_scratch, '\n', held);
+    if (!newline) return;
+
+    int sockfd = player->sockfd;
+    *newline = '\0';
+    if (run && !dispatch_command(player, receive_scratch)) return;
+    if (player->sockfd != sockfd) return;
+
+    // What came behind it takes the normal path
+    handle_messages(player, newline + 1, held - (int)(newline + 1 - receive_scratch));
+}
+
+void player_requeue_held(Player *player) {
+    // Snapshots carry the held bytes but not the class. A held buffer
+    // starts with the held command; a move there would be a partial line
+    // completed by the next read, which runs it anyway.
+    char *newline = player->buffer ? memchr(player->buffer, '\n', player->bufferPtr) : NULL;
+    if (!newline) return;
+    CommandClass class = scheduler_classify(player->buffer, newline - player->buffer);
+    if (class != CLASS_MOVE) scheduler_queue(player, class);
 }
 
-void handle_enter_queue(Player *player) {
-    const char *ptr = player->buffer + 12;   // Skip "KIVUPSenterQ"
+void player_keep_partial(Player *player, const char *data, int len) {
+    if (len <= 0) {
+        release_buffer(player);
+        return;
+    }
+    if (!player->buffer && !(player->buffer = lease_buffer())) {
+        printf("No receive buffer for player %s. Partial message dropped.\n", player->username);
+        player->bufferPtr = 0;
+        return;
+    }
+    if (len > BUFFER_SIZE - 1) len = BUFFER_SIZE - 1;
+    memmove(player->buffer, data, len);
+    player->buffer[len] = '\0';
+    player->bufferPtr = len;
+}
+
+void handle_enter_queue(Player *player, const char *message) {
+    const char *ptr = message + 12;   // Skip "KIVUPSenterQ"
     int username_len = atoi(ptr);            // Extract the length of the username
     ptr += 4;
 
@@ -157,7 +416,7 @@ void handle_enter_queue(Player *player) {
     username[username_len] = '\0';  // Explicitly null-terminate
 
     if (player->username[0] == '\0') {
-        strncpy(player->username, username, sizeof(player->username) - 1);
+        snprintf(player->username, sizeof(player->username), "%s", username);
         printf("Username set for player: %s\n", player->username);
     }
 
@@ -165,22 +424,54 @@ void handle_enter_queue(Player *player) {
 
     // Mark the player as waiting
     player->state = STATE_WAITING;
-    printf("Player %s added to the queue.\n", player->username);
+    player->queueTime = time(NULL);
+    if (profile_enabled()) {
+        Profile profile;
+        profile_lookup(player->username, &profile);
+        player->rating = profile.rating;
+        printf("Player %s (rating %d, %u-%u) added to the queue.\n", player->username, profile.rating,
+               profile.wins, profile.losses);
+    } else {
+        printf("Player %s added to the queue.\n", player->username);
+    }
+
+    match_waiting_player(player);
+}
+
+// How well two players fit by round trip; lower is better
+static long long rtt_distance(const Player *player, const Player *candidate, time_t now, int wait) {
+    if (now - candidate->queueTime >= wait) return -1;   // Waited long enough, takes anyone
+    if (!player->rttUs || !candidate->rttUs) return LLONG_MAX;
+    return llabs((long long)player->rttUs - candidate->rttUs);
+}
 
-    // Check if there is another player waiting
+void match_waiting_player(Player *player) {
+    // Check if there is another player waiting. With rtt-match-wait the one
+    // with the closest round trip is chosen, so a slow link does not set the
+    // pace for a fast one; unmeasured players match in slot order as before.
+    int wait = config()->rttMatchWait;
+    time_t now = time(NULL);
     Player *opponent = NULL;
+    long long best = LLONG_MAX;
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (&players[i] != player && players[i].state == STATE_WAITING) {
+        if (&players[i] == player || players[i].state != STATE_WAITING) continue;
+        long long distance = wait ? rtt_distance(player, &players[i], now, wait) : -1;
+        if (!opponent || distance < best) {
             opponent = &players[i];
-            break;
+            best = distance;
         }
+        if (best < 0) break;
     }
 
     // Start a game if two players are in the queue
-    if (opponent) {
+    GameSession *session = opponent ? allocate_session() : NULL;
+    if (opponent && !session) {
+        printf("No free session slot. Player %s keeps waiting.\n", player->username);
+    } else if (opponent) {
         printf("Two players found in the queue. Starting new game session...\n");
+        log_debug("Round trips %s %.1f ms, %s %.1f ms.\n", player->username, player->rttUs / 1000.0,
+                  opponent->username, opponent->rttUs / 1000.0);
 
-        GameSession *session = &sessions[session_count++];
         session->players[0] = player;
         session->players[1] = opponent;
 
@@ -194,7 +485,7 @@ void handle_enter_queue(Player *player) {
     }
 }
 
-void handle_play_card(Player *player) {
+void handle_play_card(Player *player, const char *message) {
     GameSession *session = find_session_by_username(player->username);
     if (!session) {
         printf("Player is not part of an active session.\n");
@@ -202,7 +493,7 @@ void handle_play_card(Player *player) {
         return;
     }
 
-    char *ptr = player->buffer + 12;
+    const char *ptr = message + 12;
 
     int username_len = atoi(ptr);
     ptr += 4;
@@ -225,6 +516,7 @@ void handle_play_card(Player *player) {
     // Check if a skip is pending and only allow an Ace to be played
     if (session->skipPending && strcmp(played_value, "ace") != 0) {
         printf("Invalid move: Only an Ace can be played when skip is pending.\n");
+        recorder_note(session, player, "rejected %s, skip pending", played_card);
         send_validation_response(player->sockfd, 0, NULL, 0);
         return;
     }
@@ -232,6 +524,19 @@ void handle_play_card(Player *player) {
     // Check if force draw is pending and only allow a 7 to be played
     if (session->force_draw_pending && strcmp(played_value, "7") != 0) {
         printf("Invalid move: Only a 7 can be played when force draw is pending.\n");
+        recorder_note(session, player, "rejected %s, force draw pending", played_card);
+        send_validation_response(player->sockfd, 0, NULL, 0);
+        return;
+    }
+
+    // Only a card from the player's own hand can be played
+    int in_hand = 0;
+    for (int i = 0; i < player->handSize && !in_hand; i++) {
+        in_hand = (strcmp(player->hand[i], played_card) == 0);
+    }
+    if (!in_hand) {
+        printf("Invalid move: %s is not in the hand of %s.\n", played_card, player->username);
+        recorder_note(session, player, "rejected %s, not in hand", played_card);
         send_validation_response(player->sockfd, 0, NULL, 0);
         return;
     }
@@ -239,10 +544,8 @@ void handle_play_card(Player *player) {
     // Validate move using server's active suit and value
     if (validate_move(played_suit, played_value, session->activeSuit, session->activeValue)) {
         // Update active suit and value
-        strncpy(session->activeSuit, played_suit, sizeof(session->activeSuit) - 1);
-        strncpy(session->activeValue, played_value, sizeof(session->activeValue) - 1);
-        session->activeSuit[sizeof(session->activeSuit) - 1] = '\0';
-        session->activeValue[sizeof(session->activeValue) - 1] = '\0';
+        snprintf(session->activeSuit, sizeof(session->activeSuit), "%s", played_suit);
+        snprintf(session->activeValue, sizeof(session->activeValue), "%s", played_value);
 
         // Add card to discard pile
         session->discardDeck.topCardIndex++;
@@ -262,20 +565,27 @@ void handle_play_card(Player *player) {
             }
         }
 
+        spectator_publish(session, "KIVUPSSPECTATE_PLAYED|%d|%s|H:%d,%d\n",
+                          session->players[1] == player, played_card,
+                          session->players[0] ? session->players[0]->handSize : 0,
+                          session->players[1] ? session->players[1]->handSize : 0);
+
         // Check for game over
         int game_over = (player->handSize == 0);
+        recorder_note(session, player, "played %s, hand %d", played_card, player->handSize);
         send_validation_response(player->sockfd, 1, played_card, game_over);
         // Notify the opponent of the last played card
         Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
-        if (opponent) {
+        if (opponent && opponent->sockfd != -1) {
             char opponent_message[BUFFER_SIZE];
             snprintf(opponent_message, sizeof(opponent_message), "KIVUPSCARD_PLAYED_UPDATE|%s\n", played_card);
-            send(opponent->sockfd, opponent_message, strlen(opponent_message), 0);
+            recorder_sent(session, opponent, opponent_message);
+            output_send(opponent->sockfd, opponent_message, strlen(opponent_message));
         }
 
         // Handle game over condition
         if (game_over) {
-            handle_victory(player);
+            TRACE_HANDLER("victory", session, player, handle_victory(player));
             return;
         }
 
@@ -283,19 +593,21 @@ void handle_play_card(Player *player) {
         if (strcmp(played_value, "7") == 0) {
             session->force_draw_pending = 1;   // Force draw is active
             session->force_draw_count += 2;   // Add 2 cards to the draw count
-            printf("Force draw count incremented to %d.\n", session->force_draw_count);
+            log_debug("Force draw count incremented to %d.\n", session->force_draw_count);
 
-            if (opponent->sockfd != -1) {
+            if (opponent && opponent->sockfd != -1) {
                 char opponent_message[BUFFER_SIZE];
                 snprintf(opponent_message, sizeof(opponent_message), "KIVUPSFORCEDRAW_PENDING\n");
-                send(opponent->sockfd, opponent_message, strlen(opponent_message), 0);
+                recorder_sent(session, opponent, opponent_message);
+                output_send(opponent->sockfd, opponent_message, strlen(opponent_message));
             }
         } else if (strcmp(played_value, "ace") == 0) {
             session->skipPending = 1;  // Set skip pending
-            if (opponent->sockfd != -1) {
+            if (opponent && opponent->sockfd != -1) {
                 char opponent_message[BUFFER_SIZE];
                 snprintf(opponent_message, sizeof(opponent_message), "KIVUPSSKIP_PENDING\n");
-                send(opponent->sockfd, opponent_message, strlen(opponent_message), 0);
+                recorder_sent(session, opponent, opponent_message);
+                output_send(opponent->sockfd, opponent_message, strlen(opponent_message));
             }
         } else if (strcmp(played_value, "queen") == 0) {
             printf("Queen played. Waiting for suit change.\n");
@@ -305,11 +617,12 @@ void handle_play_card(Player *player) {
         // Switch turn after normal play or if no special effect interrupts
         switch_turn(session);
     } else {
+        recorder_note(session, player, "rejected %s", played_card);
         send_validation_response(player->sockfd, 0, NULL, 0);
     }
 }
 
-void handle_suit_change(Player *player) {
+void handle_suit_change(Player *player, const char *message) {
     GameSession *session = find_session_by_username(player->username);
     if (!session) {
         printf("Player is not part of an active session.\n");
@@ -317,7 +630,7 @@ void handle_suit_change(Player *player) {
         return;
     }
 
-    char *ptr = player->buffer + 12;
+    const char *ptr = message + 12;
 
     int username_len = atoi(ptr);
     ptr += 4;
@@ -344,13 +657,15 @@ void handle_suit_change(Player *player) {
         if (p && p->sockfd != -1) { // Ensure player is valid and connected
             char message[BUFFER_SIZE];
             snprintf(message, sizeof(message), "KIVUPSSUIT_UPDATE|%s\n", session->activeSuit);
-            if (send(p->sockfd, message, strlen(message), 0) == -1) {
+            recorder_sent(session, p, message);
+            if (output_send(p->sockfd, message, strlen(message)) == -1) {
                 perror("Failed to send suit update notification");
             } else {
-                printf("Notified player %s about suit change to %s.\n", p->username, session->activeSuit);
+                log_debug("Notified player %s about suit change to %s.\n", p->username, session->activeSuit);
             }
         }
     }
+    spectator_publish(session, "KIVUPSSPECTATE_SUIT|%s\n", session->activeSuit);
     switch_turn(session);
     printf("Active suit updated to %s by player %s.\n", session->activeSuit, player->username);
 }
@@ -368,6 +683,19 @@ void handle_draw_card(Player *player, int force_draw) {
         reshuffle_discard_to_draw(session);
     }
 
+    // Every other card is in the hands; there is nothing to draw and any
+    // remaining penalty lapses
+    if (session->drawDeck.topCardIndex < 0) {
+        printf("No card left to draw for player %s.\n", player->username);
+        recorder_note(session, player, "nothing to draw, force draw %d dropped", session->force_draw_count);
+        session->force_draw_pending = 0;
+        session->force_draw_count = 0;
+        if (!force_draw) {
+            switch_turn(session);
+        }
+        return;
+    }
+
     // Draw the top card
     char *drawn_card = session->drawDeck.deck[session->drawDeck.topCardIndex--];
     strncpy(player->hand[player->handSize++], drawn_card, BUFFER_SIZE - 1);
@@ -375,7 +703,8 @@ void handle_draw_card(Player *player, int force_draw) {
 
     char response[BUFFER_SIZE];
     snprintf(response, sizeof(response), "KIVUPSDRAW_SUCCESS|%s\n", drawn_card);
-    send(player->sockfd, response, strlen(response), 0);
+    recorder_sent(session, player, response);
+    output_send(player->sockfd, response, strlen(response));
 
     // Decrement force draw count
     if (session->force_draw_pending) {
@@ -390,8 +719,12 @@ void handle_draw_card(Player *player, int force_draw) {
     // Notify opponent
     Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
     if (opponent && opponent->sockfd != -1) {
-        send(opponent->sockfd, "KIVUPSCARD_DRAWN_UPDATE\n", 24, 0);
+        recorder_sent(session, opponent, "KIVUPSCARD_DRAWN_UPDATE\n");
+        output_send(opponent->sockfd, "KIVUPSCARD_DRAWN_UPDATE\n", 24);
     }
+    spectator_publish(session, "KIVUPSSPECTATE_DRAWN|%d|H:%d,%d\n", session->players[1] == player,
+                      session->players[0] ? session->players[0]->handSize : 0,
+                      session->players[1] ? session->players[1]->handSize : 0);
 
     // Switch turn if force draw is complete
     if (!force_draw) {
@@ -407,6 +740,7 @@ void handle_skip_opponent(Player *player) {
         return;
     }
 
+    recorder_note(session, player, session->skipPending ? "skip taken" : "skip without ace pending");
     if (session->skipPending) {
         // Clear the skipPending flag
         session->skipPending = 0;
@@ -423,6 +757,7 @@ void handle_force_draw(Player *player) {
         return;
     }
 
+    recorder_note(session, player, "force draw of %d", session->force_draw_count);
     if (session->force_draw_pending && session->force_draw_count > 0) {
         int cards_to_draw = session->force_draw_count; // Store the initial draw count
         for (int i = 0; i < cards_to_draw; i++) {
@@ -446,28 +781,34 @@ void handle_victory(Player *player) {
     }
 
     printf("Player %s has won the game!\n", player->username);
+    recorder_note(session, player, "victory");
 
     // Identify the opponent
     Player *opponent = (session->players[0] == player) ? session->players[1] : session->players[0];
+    if (opponent) {
+        profile_record_match(player->username, opponent->username);
+    }
 
     // Send victory message to the winner
     const char *victory_message = "KIVUPSGAME_OVER|VICTORY\n";
-    if (send(player->sockfd, victory_message, strlen(victory_message), 0) == -1) {
+    if (output_send(player->sockfd, victory_message, strlen(victory_message)) == -1) {
         perror("Failed to send victory message");
     } else {
-        printf("Victory message sent to player %s.\n", player->username);
+        log_debug("Victory message sent to player %s.\n", player->username);
     }
 
     // Send defeat message to the opponent
     if (opponent && opponent->sockfd != -1) {
         const char *defeat_message = "KIVUPSGAME_OVER|DEFEAT\n";
-        if (send(opponent->sockfd, defeat_message, strlen(defeat_message), 0) == -1) {
+        if (output_send(opponent->sockfd, defeat_message, strlen(defeat_message)) == -1) {
             perror("Failed to send defeat message");
         } else {
-            printf("Defeat message sent to player %s.\n", opponent->username);
+            log_debug("Defeat message sent to player %s.\n", opponent->username);
         }
     }
 
+    spectator_publish(session, "KIVUPSSPECTATE_OVER|%d|%s\n", session->players[1] == player, player->username);
+
     // Save critical data, clear, and restore
     for (int i = 0; i < 2; i++) {
         Player *currentPlayer = session->players[i];
@@ -489,3 +830,26 @@ void handle_victory(Player *player) {
     cleanup_session(session);
     printf("Session cleaned up after victory. Players notified to re-enter queue.\n");
 }
+
+int handle_watch_game(Player *player, const char *message) {
+    const char *ptr = message + 12;   // Skip "KIVUPSwatchG"
+    int username_len = atoi(ptr);
+    ptr += 4;
+
+    char username[BUFFER_SIZE] = {0};
+    if (username_len >= BUFFER_SIZE) username_len = BUFFER_SIZE - 1;
+    strncpy(username, ptr, username_len);
+
+    GameSession *session = find_session_by_username(username);
+    // Game output still held for this socket must not land after the snapshot
+    output_release(player->sockfd);
+    if (!session || spectator_subscribe(player->sockfd, session) < 0) {
+        output_send(player->sockfd, "KIVUPSSPECTATE_FAILED\n", 22);
+        printf("Cannot watch the game of %s.\n", username);
+        return 0;
+    }
+
+    // The spectator table owns the socket now; free the player slot without closing it
+    clear_player_data(player);
+    return 1;
+}
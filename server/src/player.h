@@ -1,9 +1,12 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include <stdatomic.h>
 #include <time.h>
 
+#ifndef MAX_PLAYERS
 #define MAX_PLAYERS 10
+#endif
 #define BUFFER_SIZE 512
 
 typedef enum {
@@ -21,22 +24,54 @@ typedef struct {
     int handSize;
     int missedHeartbeats;
     int pendingHeartbeat;
-    char buffer[BUFFER_SIZE];
+    long long lastSeenMs; // Last inbound data, any command proves the peer is alive
+    char *buffer;       // Leased only while part of a message waits for the rest
     int bufferPtr;
     char username[BUFFER_SIZE];
+    time_t queueTime;   // When the player entered the queue
+    double tokens;      // Command rate token bucket
+    long long lastRefillMs;
+    int throttled;      // Commands dropped in a row
+    int rating;         // From the profile store at enterQ, 0 when not looked up
+    long long probeSentUs; // Heartbeat or state push waiting for the next command, 0 = none
+    int probeHeartbeat; // The waiting probe is a heartbeat, answered without anyone thinking
+    int rttUs;          // Smoothed round trip, 0 until the first sample
+    int rttVarUs;       // Smoothed deviation of the round trip (jitter)
+    int waitingClass;   // CommandClass of the command held for the scheduler, CLASS_MOVE when none
+    int expired;        // Out of heartbeats; the loop thread ends its session and clears it
+    atomic_llong heartbeatSentUs; // Heartbeat from the checker thread, taken as the probe by the loop; 0 = none
+    atomic_int missedNotice;      // First heartbeat missed; the loop thread records it and tells the opponent
 } Player;
 
+typedef struct {
+    int leased;     // Connections holding part of a message
+    int pooled;     // Returned buffers kept for the next lease
+} ReceiveStats;
+
 extern Player players[MAX_PLAYERS];
+extern ReceiveStats receive_stats;
 
 void init_players();
 void clear_player_data(Player *player);
 void disconnect_player(Player *player);
-void handle_player_message(Player *player);
-void handle_enter_queue(Player *player);
-void handle_play_card(Player *player);
-void handle_suit_change(Player *player);
+void handle_connection_closed(Player *player);
+// Reads what the socket has and handles every complete message; returns read()'s result
+int player_receive(Player *player);
+// Handles data as if it had been read from the player's socket
+void handle_player_message(Player *player, const char *data, int len);
+// Holds the start of a message until the rest arrives
+void player_keep_partial(Player *player, const char *data, int len);
+// Runs (or with run = 0 drops) the command the scheduler held, then what follows it
+void player_run_pending(Player *player, int run);
+// After a restore, hands a held command back to the scheduler
+void player_requeue_held(Player *player);
+void handle_enter_queue(Player *player, const char *message);
+void match_waiting_player(Player *player);
+void handle_play_card(Player *player, const char *message);
+void handle_suit_change(Player *player, const char *message);
 void handle_draw_card(Player *player, int force_draw);
 void handle_skip_opponent(Player *player);
 void handle_force_draw(Player *player);
 void handle_victory(Player *player);
+int handle_watch_game(Player *player, const char *message);
 #endif
\ No newline at end of file
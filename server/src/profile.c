@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Match results and player profiles. The event loop only copies a finished
+// match into a queue and reads profiles straight from the mapped index; the
+// writer thread appends results to matches.log in batches and then applies
+// them to the index. The log is the record, the index can always be rebuilt
+// from it: the header remembers how much of the log it has seen, and
+// whatever is missing is replayed at startup.
+
+typedef struct {
+    time_t time;
+    char winner[PROFILE_NAME];
+    char loser[PROFILE_NAME];
+} MatchResult;
+
+static int log_fd = -1;
+static ProfileHeader *header;
+static ProfileRecord *records;
+static MatchResult *queue;
+static int queue_head = 0;
+static int queue_count = 0;
+static ProfileStats stats;   // Guarded by queue_lock
+static int stopping = 0;
+static int writing = 0;      // The writer holds a batch it has not finished
+static pthread_t writer;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_idle = PTHREAD_COND_INITIALIZER;
+
+static uint32_t hash_name(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+static void copy_name(char *dest, const char *name) {
+    // Tabs and newlines would break the log format
+    int i = 0;
+    for (; name[i] && i < PROFILE_NAME - 1; i++) {
+        dest[i] = (name[i] == '\t' || name[i] == '\n') ? ' ' : name[i];
+    }
+    dest[i] = '\0';
+}
+
+// Slot holding the name, or the empty slot where it belongs
+static ProfileRecord *find_record(const char *name) {
+    uint32_t mask = header->capacity - 1;
+    for (uint32_t i = hash_name(name) & mask, probes = 0; probes < header->capacity; i = (i + 1) & mask, probes++) {
+        ProfileRecord *record = &records[i];
+        if (!atomic_load_explicit(&record->used, memory_order_acquire)) return record;
+        if (strcmp(record->username, name) == 0) return record;
+    }
+    return NULL;
+}
+
+// Writer thread only
+static ProfileRecord *get_record(const char *name) {
+    ProfileRecord *record = find_record(name);
+    if (!record) return NULL;
+    if (atomic_load_explicit(&record->used, memory_order_relaxed)) return record;
+    if (header->count >= header->capacity / 4 * 3) return NULL;
+
+    strcpy(record->username, name);
+    record->wins = 0;
+    record->losses = 0;
+    record->rating = PROFILE_START_RATING;
+    header->count++;
+    atomic_store_explicit(&record->used, 1, memory_order_release);
+    return record;
+}
+
+// log_end is where the match's line ends in matches.log. It becomes the
+// index's logOffset together with the match, so a crash can cost at most
+// the one match being applied rather than replaying a whole batch on top
+// of the index.
+static void apply_match(const char *winner, const char *loser, uint64_t log_end) {
+    ProfileRecord *w = get_record(winner);
+    ProfileRecord *l = get_record(loser);
+    if (!w || !l) {
+        header->logOffset = log_end;
+        pthread_mutex_lock(&queue_lock);
+        stats.dropped++;
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+
+    double expected = 1.0 / (1.0 + pow(10.0, (l->rating - w->rating) / 400.0));
+    int change = (int)lround(PROFILE_ELO_K * (1.0 - expected));
+
+    // Readers retry while seq is odd or changed under them
+    atomic_fetch_add_explicit(&w->seq, 1, memory_order_acq_rel);
+    atomic_fetch_add_explicit(&l->seq, 1, memory_order_acq_rel);
+    w->wins++;
+    w->rating += change;
+    l->losses++;
+    l->rating -= change;
+    header->logOffset = log_end;
+    atomic_fetch_add_explicit(&w->seq, 1, memory_order_release);
+    atomic_fetch_add_explicit(&l->seq, 1, memory_order_release);
+}
+
+static void replay_log() {
+    struct stat st;
+    if (fstat(log_fd, &st) < 0 || (uint64_t)st.st_size <= header->logOffset) return;
+
+    FILE *file = fdopen(dup(log_fd), "r");
+    if (!file) return;
+    fseeko(file, header->logOffset, SEEK_SET);
+
+    char line[3 * PROFILE_NAME];
+    int replayed = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char *winner = strchr(line, '\t');
+        char *loser = winner ? strchr(winner + 1, '\t') : NULL;
+        if (!loser) continue;
+        *winner++ = '\0';
+        *loser++ = '\0';
+        loser[strcspn(loser, "\n")] = '\0';
+        apply_match(winner, loser, ftello(file));
+        replayed++;
+    }
+    header->logOffset = st.st_size;
+    fclose(file);
+    printf("Replayed %d match results into the profile index.\n", replayed);
+}
+
+static void *profile_writer(void *arg) {
+    (void)arg;
+    static MatchResult batch[PROFILE_BATCH];
+    static char text[PROFILE_BATCH * (3 * PROFILE_NAME)];
+    static size_t ends[PROFILE_BATCH];   // End of each line within text
+
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_count == 0 && !stopping) {
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        if (queue_count == 0) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        int first = queue_head;
+        int count = queue_count < PROFILE_BATCH ? queue_count : PROFILE_BATCH;
+        writing = 1;
+        pthread_mutex_unlock(&queue_lock);
+
+        // The event loop only fills slots behind queue_count, so the copy
+        // needs no lock
+        for (int i = 0; i < count; i++) {
+            batch[i] = queue[(first + i) % PROFILE_QUEUE];
+        }
+        pthread_mutex_lock(&queue_lock);
+        queue_head = (queue_head + count) % PROFILE_QUEUE;
+        queue_count -= count;
+        pthread_mutex_unlock(&queue_lock);
+
+        size_t len = 0;
+        for (int i = 0; i < count; i++) {
+            len += sprintf(text + len, "%ld\t%s\t%s\n", (long)batch[i].time, batch[i].winner, batch[i].loser);
+            ends[i] = len;
+        }
+        // The writer thread is the only one appending, so the batch starts here
+        uint64_t start = lseek(log_fd, 0, SEEK_END);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = write(log_fd, text + done, len - done);
+            if (n < 0 && errno != EINTR) {
+                perror("Failed to append match results");
+                break;
+            }
+            if (n > 0) done += n;
+        }
+
+        // Lines that did not reach the log still count, but logOffset never
+        // passes what was written
+        for (int i = 0; i < count; i++) {
+            apply_match(batch[i].winner, batch[i].loser, start + (ends[i] < done ? ends[i] : done));
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        stats.written += count;
+        stats.batches++;
+        writing = 0;
+        if (queue_count == 0) pthread_cond_broadcast(&queue_idle);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+void profile_flush() {
+    if (!header) return;
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count > 0 || writing) {
+        pthread_cond_wait(&queue_idle, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void profile_close() {
+    // Results still queued at exit are written before the process ends
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(writer, NULL);
+}
+
+int profile_open(const char *dir) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/matches.log", dir);
+    log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/profiles.idx", dir);
+    int index_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    size_t size = sizeof(ProfileHeader) + (size_t)PROFILE_CAPACITY * sizeof(ProfileRecord);
+    struct stat st;
+    if (index_fd < 0 || fstat(index_fd, &st) < 0 || (st.st_size == 0 && ftruncate(index_fd, size) < 0)) {
+        perror(path);
+        return -1;
+    }
+    if (st.st_size != 0 && (size_t)st.st_size != size) {
+        fprintf(stderr, "%s was built with a different capacity. Delete it to rebuild from the log.\n", path);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    close(index_fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the profile index");
+        return -1;
+    }
+    // enterQ lookups should never wait for the disk
+    madvise(map, size, MADV_WILLNEED);
+    header = map;
+    records = (ProfileRecord *)(header + 1);
+    if (header->magic != PROFILE_MAGIC) {
+        memset(header, 0, sizeof(*header));
+        header->magic = PROFILE_MAGIC;
+        header->capacity = PROFILE_CAPACITY;
+    }
+    replay_log();
+
+    queue = calloc(PROFILE_QUEUE, sizeof(MatchResult));
+    if (!queue || pthread_create(&writer, NULL, profile_writer, NULL) != 0) {
+        fprintf(stderr, "Failed to start the profile writer.\n");
+        return -1;
+    }
+    atexit(profile_close);
+    printf("Profile store in %s: %u players.\n", dir, header->count);
+    return 0;
+}
+
+int profile_enabled() {
+    return header != NULL;
+}
+
+int profile_lookup(const char *username, Profile *out) {
+    out->wins = 0;
+    out->losses = 0;
+    out->rating = PROFILE_START_RATING;
+    if (!header) return -1;
+
+    char name[PROFILE_NAME];
+    copy_name(name, username);
+    ProfileRecord *record = find_record(name);
+    if (!record) return -1;
+
+    unsigned seq;
+    do {
+        seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        // The empty slot find_record stopped at may have just been given to
+        // another name; the one looked for can only be further along
+        if (!atomic_load_explicit(&record->used, memory_order_acquire)) return -1;
+        if (strcmp(record->username, name) != 0) {
+            record = find_record(name);
+            if (!record) return -1;
+            seq = 1;
+            continue;
+        }
+        out->wins = record->wins;
+        out->losses = record->losses;
+        out->rating = record->rating;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&record->seq, memory_order_relaxed));
+    return 0;
+}
+
+void profile_record_match(const char *winner, const char *loser) {
+    if (!header) return;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_count == PROFILE_QUEUE) {
+        // Never wait for the disk; a burst beyond the queue is lost
+        stats.dropped++;
+    } else {
+        MatchResult *result = &queue[(queue_head + queue_count) % PROFILE_QUEUE];
+        result->time = time(NULL);
+        copy_name(result->winner, winner);
+        copy_name(result->loser, loser);
+        queue_count++;
+        stats.queued++;
+        pthread_cond_signal(&queue_ready);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void profile_get_stats(ProfileStats *out) {
+    pthread_mutex_lock(&queue_lock);
+    *out = stats;
+    pthread_mutex_unlock(&queue_lock);
+}
@@ -0,0 +1,57 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define PROFILE_NAME 64          // Longer usernames are cut to 63 bytes
+#define PROFILE_CAPACITY 65536   // Index slots, a power of two; filled to 3/4 at most
+#define PROFILE_QUEUE 65536      // Results waiting for the writer thread
+#define PROFILE_BATCH 4096       // Results written with one write()
+#define PROFILE_START_RATING 1500
+#define PROFILE_ELO_K 32
+#define PROFILE_MAGIC 0x58445055 // "UPDX"
+
+typedef struct {
+    unsigned wins;
+    unsigned losses;
+    int rating;
+} Profile;
+
+// One slot of the memory-mapped index
+typedef struct {
+    atomic_uint seq;      // Odd while the writer thread updates the slot
+    atomic_uint used;
+    char username[PROFILE_NAME];
+    uint32_t wins;
+    uint32_t losses;
+    int32_t rating;
+    uint32_t reserved;
+} ProfileRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t logOffset;   // Bytes of matches.log already applied to the index
+    char pad[40];
+} ProfileHeader;
+
+typedef struct {
+    unsigned long queued;
+    unsigned long written;
+    unsigned long dropped;   // Queue full or index full
+    unsigned long batches;
+} ProfileStats;
+
+int profile_open(const char *dir);
+int profile_enabled();
+int profile_lookup(const char *username, Profile *out);
+void profile_record_match(const char *winner, const char *loser);
+// Waits until every queued result is in matches.log and the index. Only the
+// event loop queues results, so the writer stays idle while the loop waits.
+void profile_flush();
+void profile_get_stats(ProfileStats *out);
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include "recorder.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+// Flight recorder: the last RECORDER_EVENTS commands, messages and state
+// changes of every session, kept in a ring next to the session table.
+// Recording a command or sent message is a clock read and a short copy;
+// state notes are rarer and formatted into the ring as they happen. Nothing
+// is written out until a dump is asked for.
+
+const char *recorder_dir = ".";
+
+static FlightRecorder recorders[MAX_SESSIONS];
+static const char *kind_names[] = {"cmd", "sent", "state", "CHECK"};
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static RecordedEvent *next_event(GameSession *session, const Player *player, RecordKind kind) {
+    FlightRecorder *recorder = &recorders[session - sessions];
+    RecordedEvent *event = &recorder->events[recorder->next++ % RECORDER_EVENTS];
+    event->timeUs = now_us();
+    event->kind = kind;
+    event->seat = !player ? -1 : session->players[0] == player ? 0 : session->players[1] == player ? 1 : -1;
+    return event;
+}
+
+static void copy_line(char *text, const char *line) {
+    // Up to the newline; the protocol prefix carries no information
+    if (strncmp(line, "KIVUPS", 6) == 0) line += 6;
+    size_t len = strcspn(line, "\n");
+    if (len >= RECORDER_TEXT) len = RECORDER_TEXT - 1;
+    memcpy(text, line, len);
+    text[len] = '\0';
+}
+
+void recorder_reset(GameSession *session) {
+    FlightRecorder *recorder = &recorders[session - sessions];
+    recorder->next = 0;
+    recorder->dumped = 0;
+}
+
+void recorder_command(GameSession *session, const Player *player, const char *line) {
+    copy_line(next_event(session, player, REC_COMMAND)->text, line);
+}
+
+void recorder_sent(GameSession *session, const Player *player, const char *message) {
+    copy_line(next_event(session, player, REC_SENT)->text, message);
+}
+
+void recorder_note(GameSession *session, const Player *player, const char *format, ...) {
+    RecordedEvent *event = next_event(session, player, REC_STATE);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(event->text, RECORDER_TEXT, format, args);
+    va_end(args);
+}
+
+static const char *find_violation(const GameSession *session) {
+    const Player *p0 = session->players[0];
+    const Player *p1 = session->players[1];
+
+    if (session->currentTurn != 0 && session->currentTurn != 1) return "turn is neither seat";
+    if (session->drawDeck.topCardIndex < -1 || session->drawDeck.topCardIndex >= DECK_SIZE) return "draw pile index out of range";
+    if (session->discardDeck.topCardIndex < 0 || session->discardDeck.topCardIndex >= DECK_SIZE) return "discard pile index out of range";
+    if (session->force_draw_count < 0) return "negative force draw count";
+    if (session->force_draw_pending != (session->force_draw_count > 0)) return "force draw flag and count disagree";
+    if (session->skipPending && session->force_draw_pending) return "skip and force draw both pending";
+
+    // A player who left is cleared while the opponent keeps the session
+    if (!p0 || !p1 || p0->state != STATE_PLAYING || p1->state != STATE_PLAYING) return NULL;
+    if (p0->handSize < 0 || p0->handSize > 32 || p1->handSize < 0 || p1->handSize > 32) return "hand size out of range";
+    int cards = session->drawDeck.topCardIndex + 1 + session->discardDeck.topCardIndex + 1 + p0->handSize + p1->handSize;
+    if (cards != DECK_SIZE) return "cards were created or lost";
+    return NULL;
+}
+
+int recorder_check(GameSession *session) {
+    const char *violation = find_violation(session);
+    if (!violation) return 0;
+
+    FlightRecorder *recorder = &recorders[session - sessions];
+    RecordedEvent *event = next_event(session, NULL, REC_CHECK);
+    snprintf(event->text, RECORDER_TEXT, "%s", violation);
+    printf("Session %d failed a check: %s.\n", (int)(session - sessions), violation);
+
+    // One file per game is enough; the ring keeps recording either way
+    if (!recorder->dumped) {
+        recorder->dumped = 1;
+        recorder_dump(session, violation, NULL, 0);
+    }
+    return -1;
+}
+
+int recorder_dump(GameSession *session, const char *reason, char *path, size_t path_size) {
+    static unsigned int dump_count = 0;
+    FlightRecorder *recorder = &recorders[session - sessions];
+    int slot = (int)(session - sessions);
+    char name[512];
+
+    snprintf(name, sizeof(name), "%s/flight-%d-%ld-%u.log", recorder_dir, slot, (long)time(NULL), dump_count++);
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        perror("Failed to write flight recording");
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(file, "session %d: %s\nwritten %s\n", slot, reason, stamp);
+
+    for (int i = 0; i < 2; i++) {
+        Player *player = session->players[i];
+        if (!player) {
+            fprintf(file, "seat %d empty\n", i);
+            continue;
+        }
+        fprintf(file, "seat %d %s fd=%d state=%d hand=", i, player->username, player->sockfd, player->state);
+        for (int j = 0; j < player->handSize && j < 32; j++) {
+            fprintf(file, "%s%s", j ? "," : "", player->hand[j]);
+        }
+        fprintf(file, "\n");
+    }
+    fprintf(file, "turn=%d active=%s_%s draw=%d discard=%d skip=%d force_draw=%d/%d\n",
+            session->currentTurn, session->activeSuit, session->activeValue,
+            session->drawDeck.topCardIndex + 1, session->discardDeck.topCardIndex + 1,
+            session->skipPending, session->force_draw_pending, session->force_draw_count);
+
+    // Oldest first, times relative to the dump
+    unsigned int count = recorder->next < RECORDER_EVENTS ? recorder->next : RECORDER_EVENTS;
+    long long dump_time = now_us();
+    fprintf(file, "last %u of %u events:\n", count, recorder->next);
+    for (unsigned int i = recorder->next - count; i != recorder->next; i++) {
+        const RecordedEvent *event = &recorder->events[i % RECORDER_EVENTS];
+        fprintf(file, "%10.3f ms  %-5s %2d  %s\n", (event->timeUs - dump_time) / 1000.0,
+                kind_names[event->kind], event->seat, event->text);
+    }
+
+    fclose(file);
+    printf("Flight recording of session %d written to %s.\n", slot, name);
+    if (path) snprintf(path, path_size, "%s", name);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "game.h"
+#include <stddef.h>
+
+#define RECORDER_EVENTS 64  // Events kept per session, the oldest is overwritten
+#define RECORDER_TEXT 40    // Bytes kept of each command or message
+
+typedef enum {
+    REC_COMMAND,  // Line received from a player
+    REC_SENT,     // Message sent to a player
+    REC_STATE,    // Game state change
+    REC_CHECK     // Failed invariant
+} RecordKind;
+
+typedef struct {
+    long long timeUs;   // CLOCK_MONOTONIC
+    unsigned char kind;
+    signed char seat;   // 0 or 1, -1 for the session itself
+    char text[RECORDER_TEXT];
+} RecordedEvent;
+
+typedef struct {
+    RecordedEvent events[RECORDER_EVENTS];
+    unsigned int next;  // Events recorded since the game started
+    int dumped;         // A failed check already wrote this game's recording
+} FlightRecorder;
+
+extern const char *recorder_dir;  // Where dumps are written
+
+void recorder_reset(GameSession *session);
+void recorder_command(GameSession *session, const Player *player, const char *line);
+void recorder_sent(GameSession *session, const Player *player, const char *message);
+void recorder_note(GameSession *session, const Player *player, const char *format, ...);
+int recorder_check(GameSession *session);
+int recorder_dump(GameSession *session, const char *reason, char *path, size_t path_size);
+
+#endif
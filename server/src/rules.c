@@ -0,0 +1,208 @@
+#include "rules.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *suit_names[] = {"acorn", "ball", "green", "heart"};
+static const char *value_names[] = {"7", "8", "9", "10", "jack", "queen", "king", "ace"};
+
+void rules_rng_seed(RulesRng *rng, uint64_t seed) {
+    // splitmix64 so that nearby seeds give unrelated streams
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    rng->state = z ? z : 1;
+}
+
+int rules_card_from_name(const char *name) {
+    const char *sep = strchr(name, '_');
+    if (!sep) return -1;
+
+    int suit = -1;
+    for (int s = 0; s < 4; s++) {
+        if ((size_t)(sep - name) == strlen(suit_names[s]) && strncmp(name, suit_names[s], sep - name) == 0) {
+            suit = s;
+            break;
+        }
+    }
+    if (suit < 0) return -1;
+
+    for (int v = 0; v < 8; v++) {
+        if (strcmp(sep + 1, value_names[v]) == 0) {
+            return MAKE_CARD(suit, v);
+        }
+    }
+    return -1;
+}
+
+const char *rules_suit_name(int suit) {
+    return (suit >= 0 && suit < 4) ? suit_names[suit] : "";
+}
+
+void rules_card_name(uint8_t card, char *out, int size) {
+    snprintf(out, size, "%s_%s", suit_names[CARD_SUIT(card)], value_names[CARD_VALUE(card)]);
+}
+
+void rules_new_game(CompactGame *game, RulesRng *rng) {
+    memset(game, 0, sizeof(*game));
+    game->winner = RULES_NO_WINNER;
+
+    // Same layout and swap loop as init_deck()
+    for (int i = 0; i < RULES_DECK_SIZE; i++) {
+        game->drawPile[i] = (uint8_t)i;
+    }
+    for (int i = 0; i < RULES_DECK_SIZE; i++) {
+        int j = rules_rng_below(rng, RULES_DECK_SIZE);
+        uint8_t temp = game->drawPile[i];
+        game->drawPile[i] = game->drawPile[j];
+        game->drawPile[j] = temp;
+    }
+    game->drawTop = RULES_DECK_SIZE - 1;
+
+    // Same order as deal_initial_hands(): discard first, then five cards each
+    uint8_t first = game->drawPile[game->drawTop--];
+    game->discardPile[0] = first;
+    game->discardTop = 0;
+    game->activeSuit = CARD_SUIT(first);
+    game->activeValue = CARD_VALUE(first);
+
+    for (int p = 0; p < 2; p++) {
+        for (int j = 0; j < RULES_HAND_SIZE; j++) {
+            game->hand[p][game->handSize[p]++] = game->drawPile[game->drawTop--];
+        }
+    }
+
+    game->currentTurn = rules_rng_below(rng, 2);
+}
+
+int rules_legal_moves(const CompactGame *game, Move *moves) {
+    int count = 0;
+    int turn = game->currentTurn;
+
+    if (game->winner != RULES_NO_WINNER) return 0;
+
+    for (int i = 0; i < game->handSize[turn]; i++) {
+        uint8_t card = game->hand[turn][i];
+        int suit = CARD_SUIT(card);
+        int value = CARD_VALUE(card);
+
+        // Mirrors the checks in handle_play_card()
+        if (game->skipPending && value != VALUE_ACE) continue;
+        if (game->forceDrawCount && value != VALUE_7) continue;
+        if (suit != game->activeSuit && value != game->activeValue) continue;
+
+        if (value == VALUE_QUEEN) {
+            for (int s = 0; s < 4; s++) {
+                moves[count++] = (Move){MOVE_PLAY, card, (uint8_t)s};
+            }
+        } else {
+            moves[count++] = (Move){MOVE_PLAY, card, (uint8_t)suit};
+        }
+    }
+
+    if (game->skipPending) {
+        moves[count++] = (Move){MOVE_SKIP, 0, 0};
+    } else if (game->forceDrawCount) {
+        moves[count++] = (Move){MOVE_FORCE_DRAW, 0, 0};
+    } else {
+        moves[count++] = (Move){MOVE_DRAW, 0, 0};
+    }
+
+    return count;
+}
+
+static void reshuffle(CompactGame *game) {
+    // Same as reshuffle_discard_to_draw(): order is kept, top card stays
+    if (game->discardTop < 1) return;
+
+    memcpy(game->drawPile, game->discardPile, game->discardTop);
+    game->drawTop = game->discardTop - 1;
+    game->discardPile[0] = game->discardPile[game->discardTop];
+    game->discardTop = 0;
+    game->reshuffles++;
+}
+
+static void draw_one(CompactGame *game, int player) {
+    if (game->drawTop < 0) {
+        reshuffle(game);
+    }
+    if (game->drawTop < 0) {
+        game->dryDraws++;
+        return;
+    }
+    game->hand[player][game->handSize[player]++] = game->drawPile[game->drawTop--];
+}
+
+void rules_apply(CompactGame *game, const Move *move) {
+    int turn = game->currentTurn;
+    game->plies++;
+
+    switch (move->type) {
+    case MOVE_PLAY: {
+        uint8_t *hand = game->hand[turn];
+        for (int i = 0; i < game->handSize[turn]; i++) {
+            if (hand[i] == move->card) {
+                memmove(&hand[i], &hand[i + 1], game->handSize[turn] - i - 1);
+                game->handSize[turn]--;
+                break;
+            }
+        }
+
+        game->discardPile[++game->discardTop] = move->card;
+        game->activeSuit = CARD_SUIT(move->card);
+        game->activeValue = CARD_VALUE(move->card);
+
+        if (game->handSize[turn] == 0) {
+            game->winner = turn;
+            return;
+        }
+
+        if (game->activeValue == VALUE_7) {
+            if (game->forceDrawCount) game->stackedSevens++;
+            game->forceDrawCount += 2;
+        } else if (game->activeValue == VALUE_ACE) {
+            game->skipPending = 1;
+        } else if (game->activeValue == VALUE_QUEEN) {
+            game->activeSuit = move->suit;
+        }
+        break;
+    }
+    case MOVE_DRAW:
+        draw_one(game, turn);
+        if (game->forceDrawCount) game->forceDrawCount--;
+        break;
+    case MOVE_FORCE_DRAW:
+        while (game->forceDrawCount) {
+            draw_one(game, turn);
+            game->forceDrawCount--;
+        }
+        break;
+    case MOVE_SKIP:
+        game->skipPending = 0;
+        break;
+    }
+
+    game->currentTurn ^= 1;
+}
+
+void rules_random_move(const CompactGame *game, RulesRng *rng, Move *move) {
+    Move moves[RULES_MAX_MOVES];
+    int count = rules_legal_moves(game, moves);
+    *move = moves[count > 1 ? rules_rng_below(rng, count) : 0];
+}
+
+void rules_greedy_move(const CompactGame *game, RulesRng *rng, Move *move) {
+    // Random card if one can be played, drawing/skipping is the last move listed
+    Move moves[RULES_MAX_MOVES];
+    int count = rules_legal_moves(game, moves);
+    *move = moves[count > 1 ? rules_rng_below(rng, count - 1) : 0];
+}
+
+int rules_playout(CompactGame *game, RulesRng *rng, int max_plies) {
+    Move move;
+    while (game->winner == RULES_NO_WINNER && game->plies < max_plies) {
+        rules_greedy_move(game, rng, &move);
+        rules_apply(game, &move);
+    }
+    return game->winner;
+}
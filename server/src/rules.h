@@ -0,0 +1,84 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+
+// Compact model of the game rules used by the bot engine and offline tools.
+// Cards are a single byte: suit in the high bits, value in the low three.
+#define RULES_DECK_SIZE 32
+#define RULES_HAND_SIZE 5
+#define RULES_NO_WINNER 0xFF
+#define RULES_MAX_MOVES 64
+
+#define CARD_SUIT(card) ((card) >> 3)
+#define CARD_VALUE(card) ((card) & 7)
+#define MAKE_CARD(suit, value) ((uint8_t)(((suit) << 3) | (value)))
+
+enum { SUIT_ACORN, SUIT_BALL, SUIT_GREEN, SUIT_HEART };
+enum { VALUE_7, VALUE_8, VALUE_9, VALUE_10, VALUE_JACK, VALUE_QUEEN, VALUE_KING, VALUE_ACE };
+
+typedef enum {
+    MOVE_PLAY,       // playCa (+ suitCh for a queen)
+    MOVE_DRAW,       // drawCa
+    MOVE_SKIP,       // skipMv
+    MOVE_FORCE_DRAW  // forceD
+} MoveType;
+
+typedef struct {
+    uint8_t type;   // MoveType
+    uint8_t card;   // Card played (MOVE_PLAY only)
+    uint8_t suit;   // Suit chosen after a queen
+} Move;
+
+typedef struct {
+    uint8_t hand[2][RULES_DECK_SIZE];
+    uint8_t handSize[2];
+    uint8_t drawPile[RULES_DECK_SIZE];
+    uint8_t discardPile[RULES_DECK_SIZE];
+    int8_t drawTop;         // Index of the top card, -1 when empty
+    int8_t discardTop;
+    uint8_t activeSuit;
+    uint8_t activeValue;
+    uint8_t currentTurn;
+    uint8_t skipPending;
+    uint8_t forceDrawCount; // Non-zero while a 7 penalty is pending
+    uint8_t winner;         // RULES_NO_WINNER while the game is running
+    uint16_t plies;
+    // Wide enough for a game that runs to the simulator's ply cap
+    uint16_t reshuffles;
+    uint16_t stackedSevens; // Penalties that grew past a single 7
+    uint16_t dryDraws;      // Draws that found both piles empty
+} CompactGame;
+
+typedef struct {
+    uint64_t state;
+} RulesRng;
+
+static inline uint64_t rules_rng_next(RulesRng *rng) {
+    // xorshift64*
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint32_t rules_rng_below(RulesRng *rng, uint32_t bound) {
+    return (uint32_t)(((rules_rng_next(rng) >> 32) * bound) >> 32);
+}
+
+void rules_rng_seed(RulesRng *rng, uint64_t seed);
+
+int rules_card_from_name(const char *name);
+const char *rules_suit_name(int suit);
+void rules_card_name(uint8_t card, char *out, int size);
+
+void rules_new_game(CompactGame *game, RulesRng *rng);
+int rules_legal_moves(const CompactGame *game, Move *moves);
+void rules_apply(CompactGame *game, const Move *move);
+void rules_random_move(const CompactGame *game, RulesRng *rng, Move *move);
+void rules_greedy_move(const CompactGame *game, RulesRng *rng, Move *move);
+int rules_playout(CompactGame *game, RulesRng *rng, int max_plies);
+
+#endif
@@ -0,0 +1,69 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include "config.h"
+#include <string.h>
+#include <stdatomic.h>
+
+SchedulerStats scheduler_stats;
+const char *const command_class_names[CLASS_COUNT] = {"move", "reconnect", "queue", "liveness"};
+
+static atomic_int waiting;            // Players with a held command; the checker thread may clear one
+static int cursor[CLASS_COUNT];       // Where each class continues after running out of budget
+
+CommandClass scheduler_classify(const char *line, int len) {
+    // Anything malformed runs at once and is rejected there
+    if (len < 12 || strncmp(line, "KIVUPS", 6) != 0) return CLASS_MOVE;
+
+    const char *opcode = line + 6;
+    if (strncmp(opcode, "heartB", 6) == 0) return CLASS_LIVENESS;
+    if (strncmp(opcode, "enterQ", 6) == 0 || strncmp(opcode, "watchG", 6) == 0 ||
+        strncmp(opcode, "rQueue", 6) == 0) return CLASS_QUEUE;
+    if (strncmp(opcode, "reconn", 6) == 0) return CLASS_RECONNECT;
+    return CLASS_MOVE;
+}
+
+void scheduler_queue(Player *player, CommandClass class) {
+    if (player->waitingClass == CLASS_MOVE) atomic_fetch_add(&waiting, 1);
+    player->waitingClass = class;
+}
+
+void scheduler_done(Player *player) {
+    if (player->waitingClass != CLASS_MOVE) atomic_fetch_sub(&waiting, 1);
+    player->waitingClass = CLASS_MOVE;
+}
+
+int scheduler_waiting() {
+    return atomic_load(&waiting);
+}
+
+void scheduler_run() {
+    if (!atomic_load(&waiting)) return;
+
+    const Config *settings = config();
+    int budgets[CLASS_COUNT] = {0, settings->budgetReconnect, settings->budgetQueue, settings->budgetLiveness};
+
+    // A command may leave another one of a lower class behind it, which is
+    // served later in the same pass
+    for (int class = CLASS_RECONNECT; class < CLASS_COUNT; class++) {
+        int used = 0;
+        for (int n = 0; n < MAX_PLAYERS; n++) {
+            int i = (cursor[class] + n) % MAX_PLAYERS;
+            if (players[i].waitingClass != class) continue;
+
+            if (budgets[class] && used == budgets[class]) {
+                if (class == CLASS_LIVENESS) {
+                    player_run_pending(&players[i], 0);
+                    scheduler_stats.shed++;
+                    continue;
+                }
+                // The rest waits for the next iteration, starting here
+                cursor[class] = i;
+                scheduler_stats.exhausted[class]++;
+                break;
+            }
+            player_run_pending(&players[i], 1);
+            scheduler_stats.run[class]++;
+            used++;
+        }
+    }
+}
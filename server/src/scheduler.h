@@ -0,0 +1,36 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "player.h"
+
+// Commands in the order they are served. Moves run as soon as they are
+// read; the other classes wait until every read of the loop iteration is
+// done and then get a bounded number of commands per iteration each.
+typedef enum {
+    CLASS_MOVE,       // Commands of a game in progress, never held
+    CLASS_RECONNECT,
+    CLASS_QUEUE,      // enterQ, watchG
+    CLASS_LIVENESS,   // heartB; dropped when over budget, the read already proved liveness
+    CLASS_COUNT
+} CommandClass;
+
+typedef struct {
+    unsigned long run[CLASS_COUNT];
+    unsigned long exhausted[CLASS_COUNT];  // Iterations that ended with commands of the class left over
+    unsigned long shed;                    // Liveness commands dropped
+} SchedulerStats;
+
+extern SchedulerStats scheduler_stats;
+extern const char *const command_class_names[CLASS_COUNT];
+
+// line points at a complete command of len bytes, without the newline
+CommandClass scheduler_classify(const char *line, int len);
+void scheduler_queue(Player *player, CommandClass class);
+// Takes the player out of the scheduler, safe to call when it is not queued
+void scheduler_done(Player *player);
+// Serves held commands by class within the per-iteration budgets
+void scheduler_run();
+// Commands held over from an earlier iteration
+int scheduler_waiting();
+
+#endif
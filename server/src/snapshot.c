@@ -0,0 +1,163 @@
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void reserve(SnapWriter *w, size_t extra) {
+    if (w->failed || w->len + extra <= w->cap) return;
+
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + extra) cap *= 2;
+
+    char *data = realloc(w->data, cap);
+    if (!data) {
+        w->failed = 1;
+        return;
+    }
+    w->data = data;
+    w->cap = cap;
+}
+
+void snap_put_u32(SnapWriter *w, uint32_t value) {
+    reserve(w, 4);
+    if (w->failed) return;
+    for (int i = 0; i < 4; i++) {
+        w->data[w->len++] = (char)(value >> (8 * i));
+    }
+}
+
+void snap_put_i64(SnapWriter *w, int64_t value) {
+    snap_put_u32(w, (uint32_t)((uint64_t)value & 0xFFFFFFFFu));
+    snap_put_u32(w, (uint32_t)((uint64_t)value >> 32));
+}
+
+void snap_put_bytes(SnapWriter *w, const void *data, uint32_t len) {
+    snap_put_u32(w, len);
+    reserve(w, len);
+    if (w->failed) return;
+    memcpy(w->data + w->len, data, len);
+    w->len += len;
+}
+
+void snap_put_str(SnapWriter *w, const char *str) {
+    snap_put_bytes(w, str, (uint32_t)strlen(str));
+}
+
+uint32_t snap_get_u32(SnapReader *r) {
+    if (r->failed || r->pos + 4 > r->len) {
+        r->failed = 1;
+        return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)(unsigned char)r->data[r->pos++] << (8 * i);
+    }
+    return value;
+}
+
+int64_t snap_get_i64(SnapReader *r) {
+    uint64_t low = snap_get_u32(r);
+    uint64_t high = snap_get_u32(r);
+    return (int64_t)(low | (high << 32));
+}
+
+uint32_t snap_get_bytes(SnapReader *r, void *out, uint32_t max) {
+    uint32_t len = snap_get_u32(r);
+    if (r->failed || len > max || r->pos + len > r->len) {
+        r->failed = 1;
+        return 0;
+    }
+    memcpy(out, r->data + r->pos, len);
+    r->pos += len;
+    return len;
+}
+
+void snap_get_str(SnapReader *r, char *out, uint32_t size) {
+    uint32_t len = snap_get_bytes(r, out, size - 1);
+    out[len] = '\0';
+}
+
+void snap_free(SnapWriter *w) {
+    free(w->data);
+    w->data = NULL;
+    w->len = w->cap = 0;
+}
+
+void snapshot_put_player(SnapWriter *w, const Player *player, int fd_index) {
+    snap_put_u32(w, (uint32_t)fd_index);
+    snap_put_u32(w, player->state);
+    snap_put_str(w, player->username);
+    snap_put_u32(w, player->handSize);
+    for (int i = 0; i < player->handSize; i++) {
+        snap_put_str(w, player->hand[i]);
+    }
+    snap_put_u32(w, player->missedHeartbeats);
+    snap_put_u32(w, player->pendingHeartbeat);
+    snap_put_bytes(w, player->buffer ? player->buffer : "", player->bufferPtr);
+    snap_put_i64(w, player->queueTime);
+}
+
+void snapshot_get_player(SnapReader *r, Player *player, int *fd_index) {
+    clear_player_data(player);
+
+    *fd_index = (int)snap_get_u32(r);
+    player->state = (PlayerState)snap_get_u32(r);
+    snap_get_str(r, player->username, sizeof(player->username));
+    player->handSize = (int)snap_get_u32(r);
+    if (player->handSize < 0 || player->handSize > 32) {
+        r->failed = 1;
+        player->handSize = 0;
+    }
+    for (int i = 0; i < player->handSize; i++) {
+        snap_get_str(r, player->hand[i], sizeof(player->hand[i]));
+    }
+    player->missedHeartbeats = (int)snap_get_u32(r);
+    player->pendingHeartbeat = (int)snap_get_u32(r);
+    char partial[BUFFER_SIZE];
+    player_keep_partial(player, partial, (int)snap_get_bytes(r, partial, sizeof(partial) - 1));
+    player->queueTime = (time_t)snap_get_i64(r);
+}
+
+static void put_deck(SnapWriter *w, const CardDeck *deck) {
+    snap_put_u32(w, (uint32_t)deck->topCardIndex);
+    for (int i = 0; i <= deck->topCardIndex; i++) {
+        snap_put_str(w, deck->deck[i]);
+    }
+}
+
+static void get_deck(SnapReader *r, CardDeck *deck) {
+    memset(deck->deck, 0, sizeof(deck->deck));
+    deck->topCardIndex = (int)snap_get_u32(r);
+    if (deck->topCardIndex < -1 || deck->topCardIndex >= DECK_SIZE) {
+        r->failed = 1;
+        deck->topCardIndex = -1;
+    }
+    for (int i = 0; i <= deck->topCardIndex; i++) {
+        snap_get_str(r, deck->deck[i], sizeof(deck->deck[i]));
+    }
+}
+
+void snapshot_put_session(SnapWriter *w, const GameSession *session, int slot0, int slot1) {
+    snap_put_u32(w, (uint32_t)slot0);
+    snap_put_u32(w, (uint32_t)slot1);
+    put_deck(w, &session->drawDeck);
+    put_deck(w, &session->discardDeck);
+    snap_put_u32(w, (uint32_t)session->currentTurn);
+    snap_put_str(w, session->activeSuit);
+    snap_put_str(w, session->activeValue);
+    snap_put_u32(w, session->skipPending);
+    snap_put_u32(w, session->force_draw_pending);
+    snap_put_u32(w, session->force_draw_count);
+}
+
+void snapshot_get_session(SnapReader *r, GameSession *session, int *slot0, int *slot1) {
+    *slot0 = (int)snap_get_u32(r);
+    *slot1 = (int)snap_get_u32(r);
+    get_deck(r, &session->drawDeck);
+    get_deck(r, &session->discardDeck);
+    session->currentTurn = (int)snap_get_u32(r);
+    snap_get_str(r, session->activeSuit, sizeof(session->activeSuit));
+    snap_get_str(r, session->activeValue, sizeof(session->activeValue));
+    session->skipPending = (int)snap_get_u32(r);
+    session->force_draw_pending = (int)snap_get_u32(r);
+    session->force_draw_count = (int)snap_get_u32(r);
+}
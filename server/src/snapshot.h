@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "game.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Field-by-field encoding of players and sessions, so state can move between
+// processes whose struct layouts differ. Integers are little endian.
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} SnapWriter;
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos;
+    int failed;
+} SnapReader;
+
+void snap_put_u32(SnapWriter *w, uint32_t value);
+void snap_put_i64(SnapWriter *w, int64_t value);
+void snap_put_bytes(SnapWriter *w, const void *data, uint32_t len);
+void snap_put_str(SnapWriter *w, const char *str);
+uint32_t snap_get_u32(SnapReader *r);
+int64_t snap_get_i64(SnapReader *r);
+uint32_t snap_get_bytes(SnapReader *r, void *out, uint32_t max);
+void snap_get_str(SnapReader *r, char *out, uint32_t size);
+void snap_free(SnapWriter *w);
+
+// fd_index refers to the descriptor list sent alongside the snapshot, -1 for none
+void snapshot_put_player(SnapWriter *w, const Player *player, int fd_index);
+void snapshot_get_player(SnapReader *r, Player *player, int *fd_index);
+void snapshot_put_session(SnapWriter *w, const GameSession *session, int slot0, int slot1);
+void snapshot_get_session(SnapReader *r, GameSession *session, int *slot0, int *slot1);
+
+#endif
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include "spectator.h"
+#include "network.h"
+#include "admission.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+typedef struct {
+    int sockfd;                  // -1 when the slot is free
+    GameSession *session;        // NULL once the game ended and the queue drains
+    int prev;                    // Neighbours in the session's spectator list
+    int next;
+    EventBuffer *queue[SPECTATOR_QUEUE];
+    int head;
+    int count;
+    int offset;                  // Bytes of queue[head] already sent
+} Spectator;
+
+static Spectator spectators[MAX_SPECTATORS];
+static int free_slots[MAX_SPECTATORS];
+static int free_count = 0;
+
+void init_spectators() {
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        spectators[i].sockfd = -1;
+        free_slots[free_count++] = MAX_SPECTATORS - 1 - i;
+    }
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        sessions[i].firstSpectator = -1;
+        sessions[i].spectatorCount = 0;
+    }
+}
+
+static void release_buffer(EventBuffer *buffer) {
+    if (--buffer->refs == 0) {
+        free(buffer);
+    }
+}
+
+static void unlink_spectator(int index) {
+    Spectator *spectator = &spectators[index];
+    GameSession *session = spectator->session;
+    if (!session) return;
+
+    if (spectator->prev >= 0) spectators[spectator->prev].next = spectator->next;
+    else session->firstSpectator = spectator->next;
+    if (spectator->next >= 0) spectators[spectator->next].prev = spectator->prev;
+
+    session->spectatorCount--;
+    spectator->session = NULL;
+}
+
+static void remove_spectator(int index) {
+    Spectator *spectator = &spectators[index];
+
+    unlink_spectator(index);
+    while (spectator->count > 0) {
+        release_buffer(spectator->queue[spectator->head]);
+        spectator->head = (spectator->head + 1) % SPECTATOR_QUEUE;
+        spectator->count--;
+    }
+
+    admission_release(spectator->sockfd);
+    close(spectator->sockfd);
+    FD_CLR(spectator->sockfd, &all_fds);
+    spectator->sockfd = -1;
+    free_slots[free_count++] = index;
+}
+
+static int enqueue(int index, EventBuffer *buffer) {
+    Spectator *spectator = &spectators[index];
+    if (spectator->count == SPECTATOR_QUEUE) {
+        return -1;
+    }
+    spectator->queue[(spectator->head + spectator->count) % SPECTATOR_QUEUE] = buffer;
+    spectator->count++;
+    buffer->refs++;
+    return 0;
+}
+
+static EventBuffer *encode(const char *format, va_list args) {
+    char text[BUFFER_SIZE];
+    int len = vsnprintf(text, sizeof(text), format, args);
+    if (len < 0) return NULL;
+    if (len >= (int)sizeof(text)) len = sizeof(text) - 1;
+
+    EventBuffer *buffer = malloc(sizeof(EventBuffer) + len);
+    if (!buffer) return NULL;
+    buffer->refs = 0;
+    buffer->len = len;
+    memcpy(buffer->data, text, len);
+    return buffer;
+}
+
+static void send_to_one(int index, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    EventBuffer *buffer = encode(format, args);
+    va_end(args);
+
+    if (buffer && enqueue(index, buffer) < 0) free(buffer);
+}
+
+static int link_spectator(int sockfd, GameSession *session) {
+    if (free_count == 0) {
+        printf("Spectator limit reached.\n");
+        return -1;
+    }
+
+    int index = free_slots[--free_count];
+    Spectator *spectator = &spectators[index];
+    spectator->sockfd = sockfd;
+    spectator->session = session;
+    spectator->head = 0;
+    spectator->count = 0;
+    spectator->offset = 0;
+
+    spectator->prev = -1;
+    spectator->next = session->firstSpectator;
+    if (session->firstSpectator >= 0) spectators[session->firstSpectator].prev = index;
+    session->firstSpectator = index;
+    session->spectatorCount++;
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    return index;
+}
+
+int spectator_subscribe(int sockfd, GameSession *session) {
+    int index = link_spectator(sockfd, session);
+    if (index < 0) return -1;
+
+    // Public snapshot only: hand sizes, never the cards
+    Player *p0 = session->players[0];
+    Player *p1 = session->players[1];
+    send_to_one(index, "KIVUPSSPECTATE_STATE|P:%s,%s|D:%s|S:%s|H:%d,%d|T:%d\n",
+                p0 ? p0->username : "", p1 ? p1->username : "",
+                session->discardDeck.topCardIndex >= 0 ? session->discardDeck.deck[session->discardDeck.topCardIndex] : "",
+                session->activeSuit,
+                p0 ? p0->handSize : 0, p1 ? p1->handSize : 0, session->currentTurn);
+
+    printf("Spectator (fd: %d) watching session of %s (%d watchers).\n",
+           sockfd, p0 ? p0->username : "?", session->spectatorCount);
+    return 0;
+}
+
+void spectator_publish(GameSession *session, const char *format, ...) {
+    if (!session || session->spectatorCount == 0) return;
+
+    va_list args;
+    va_start(args, format);
+    EventBuffer *buffer = encode(format, args);
+    va_end(args);
+    if (!buffer) return;
+
+    // The same buffer is referenced from every queue, encoded exactly once
+    buffer->refs = 1;
+    int index = session->firstSpectator;
+    while (index >= 0) {
+        int next = spectators[index].next;
+        if (enqueue(index, buffer) < 0) {
+            printf("Spectator (fd: %d) fell behind. Dropping.\n", spectators[index].sockfd);
+            remove_spectator(index);
+        }
+        index = next;
+    }
+    release_buffer(buffer);
+}
+
+static int flush_spectator(int index);
+
+int spectator_info(int index, int *sockfd, GameSession **session) {
+    if (index < 0 || index >= MAX_SPECTATORS || spectators[index].sockfd == -1 || !spectators[index].session) {
+        return -1;
+    }
+
+    // Same rule as spectator_detach: only a watcher between whole events is
+    // handed on. Push out what the socket takes now; one still flushing is
+    // left here and closes with this process
+    if (spectators[index].count > 0 && flush_spectator(index) < 0) {
+        remove_spectator(index);
+        return -1;
+    }
+    if (spectators[index].count > 0) return -1;
+
+    *sockfd = spectators[index].sockfd;
+    *session = spectators[index].session;
+    return 0;
+}
+
+int spectator_adopt(int sockfd, GameSession *session) {
+    if (link_spectator(sockfd, session) < 0) return -1;
+    FD_SET(sockfd, &all_fds);
+    if (sockfd > max_fd) max_fd = sockfd;
+    return 0;
+}
+
+int spectator_detach(int index) {
+    // Hands the socket over only between whole events; a watcher still
+    // flushing stays here, drains its queue and closes
+    Spectator *spectator = &spectators[index];
+    unlink_spectator(index);
+    if (spectator->count > 0) return -1;
+
+    int sockfd = spectator->sockfd;
+    admission_release(sockfd);
+    FD_CLR(sockfd, &all_fds);
+    spectator->sockfd = -1;
+    free_slots[free_count++] = index;
+    return sockfd;
+}
+
+int spectator_active() {
+    return MAX_SPECTATORS - free_count;
+}
+
+void spectator_end_session(GameSession *session) {
+    spectator_publish(session, "KIVUPSSPECTATE_END\n");
+
+    // Spectators stay open until their queues are flushed, then close
+    while (session->firstSpectator >= 0) {
+        unlink_spectator(session->firstSpectator);
+    }
+}
+
+void spectator_prepare_fds(fd_set *write_fds) {
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        if (spectators[i].sockfd != -1 && spectators[i].count > 0) {
+            FD_SET(spectators[i].sockfd, write_fds);
+        }
+    }
+}
+
+static int flush_spectator(int index) {
+    Spectator *spectator = &spectators[index];
+
+    while (spectator->count > 0) {
+        struct iovec iov[SPECTATOR_IOV];
+        int n = 0;
+        for (; n < spectator->count && n < SPECTATOR_IOV; n++) {
+            EventBuffer *buffer = spectator->queue[(spectator->head + n) % SPECTATOR_QUEUE];
+            int skip = n == 0 ? spectator->offset : 0;
+            iov[n].iov_base = buffer->data + skip;
+            iov[n].iov_len = buffer->len - skip;
+        }
+
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(spectator->sockfd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        // Pop every buffer that went out completely
+        while (sent > 0) {
+            EventBuffer *buffer = spectator->queue[spectator->head];
+            int left = buffer->len - spectator->offset;
+            if (sent < left) {
+                spectator->offset += sent;
+                break;
+            }
+            sent -= left;
+            spectator->offset = 0;
+            spectator->head = (spectator->head + 1) % SPECTATOR_QUEUE;
+            spectator->count--;
+            release_buffer(buffer);
+        }
+    }
+    return 0;
+}
+
+void spectator_handle_io(fd_set *read_fds, fd_set *write_fds) {
+    (void)write_fds;
+
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        Spectator *spectator = &spectators[i];
+        if (spectator->sockfd == -1) continue;
+
+        // Spectators have nothing to say; anything readable is discarded or EOF
+        if (FD_ISSET(spectator->sockfd, read_fds)) {
+            char discard[BUFFER_SIZE];
+            ssize_t n = read(spectator->sockfd, discard, sizeof(discard));
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                printf("Spectator (fd: %d) left.\n", spectator->sockfd);
+                remove_spectator(i);
+                continue;
+            }
+        }
+
+        if (spectator->count > 0 && flush_spectator(i) < 0) {
+            remove_spectator(i);
+            continue;
+        }
+
+        if (!spectator->session && spectator->count == 0) {
+            remove_spectator(i);
+        }
+    }
+}
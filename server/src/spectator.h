@@ -0,0 +1,29 @@
+#ifndef SPECTATOR_H
+#define SPECTATOR_H
+
+#include "game.h"
+#include <sys/select.h>
+
+#define MAX_SPECTATORS 1000  // select() caps descriptors at FD_SETSIZE
+#define SPECTATOR_QUEUE 64   // Events a slow watcher may fall behind before it is dropped
+#define SPECTATOR_IOV 16
+
+// One encoded event, shared by every spectator queue that holds it
+typedef struct {
+    int refs;
+    int len;
+    char data[];
+} EventBuffer;
+
+void init_spectators();
+int spectator_subscribe(int sockfd, GameSession *session);
+void spectator_publish(GameSession *session, const char *format, ...);
+void spectator_end_session(GameSession *session);
+int spectator_info(int index, int *sockfd, GameSession **session);
+int spectator_adopt(int sockfd, GameSession *session);
+int spectator_detach(int index);
+int spectator_active();
+void spectator_prepare_fds(fd_set *write_fds);
+void spectator_handle_io(fd_set *read_fds, fd_set *write_fds);
+
+#endif
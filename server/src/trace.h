@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "game.h"
+
+// Static probes for perf and bpftrace, provider "ups". With systemtap's
+// <sys/sdt.h> installed each probe is a single nop plus an ELF note that a
+// tracer patches at runtime; without it, or with -DUPS_NO_PROBES, they compile
+// to nothing. tools/*.bt lists them with their arguments.
+
+#if defined(__has_include) && !defined(UPS_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define UPS_PROBES 1
+#endif
+#endif
+
+// Arguments must be scalars or pointers; cast a char array to const char *
+#ifdef UPS_PROBES
+#define TRACE2(name, a, b) DTRACE_PROBE2(ups, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(ups, name, a, b, c)
+// handler_entry and handler_return around one handler call, by name
+#define TRACE_HANDLER(name, session, player, call) do { \
+        int trace_s = trace_session(session), trace_p = trace_player(player); \
+        TRACE3(handler_entry, (const char *)(name), trace_s, trace_p); \
+        call; \
+        TRACE3(handler_return, (const char *)(name), trace_s, trace_p); \
+    } while (0)
+#else
+#define TRACE2(name, a, b) do { } while (0)
+#define TRACE3(name, a, b, c) do { } while (0)
+#define TRACE_HANDLER(name, session, player, call) do { call; } while (0)
+#endif
+
+// Slot numbers as the admin socket shows them, -1 for none
+static inline int trace_player(const Player *player) {
+    return player ? (int)(player - players) : -1;
+}
+
+static inline int trace_session(const GameSession *session) {
+    return session ? (int)(session - sessions) : -1;
+}
+
+#endif
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+#include "upgrade.h"
+#include "snapshot.h"
+#include "game.h"
+#include "network.h"
+#include "bot.h"
+#include "spectator.h"
+#include "admission.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+// Graceful binary upgrade: the running server listens on a Unix socket; a new
+// binary started with --takeover connects, receives the listening socket and
+// every client descriptor via SCM_RIGHTS plus a snapshot of players[] and
+// sessions[], and carries on serving. The old process exits after the ack.
+
+typedef struct {
+    uint32_t magic;
+    uint32_t fdCount;
+    uint32_t snapshotLen;
+    uint32_t reserved;
+    int64_t startNs;       // CLOCK_MONOTONIC is shared by both processes
+} UpgradeHeader;
+
+static int upgrade_fd = -1;
+
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int read_full(int fd, void *data, size_t len) {
+    char *ptr = data;
+    while (len > 0) {
+        ssize_t n = read(fd, ptr, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_full(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = send(fd, ptr, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int send_fds(int sock, const int *fds, int count) {
+    for (int sent = 0; sent < count; sent += UPGRADE_FD_BATCH) {
+        uint32_t batch = count - sent < UPGRADE_FD_BATCH ? count - sent : UPGRADE_FD_BATCH;
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+        struct iovec iov = {&batch, sizeof(batch)};
+        struct msghdr msg = {0};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+        memcpy(CMSG_DATA(cmsg), fds + sent, sizeof(int) * batch);
+
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(batch)) {
+            perror("Failed to pass descriptors");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int recv_fds(int sock, int *fds, int count) {
+    int received = 0;
+    while (received < count) {
+        uint32_t batch = 0;
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+        struct iovec iov = {&batch, sizeof(batch)};
+        struct msghdr msg = {0};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock, &msg, MSG_WAITALL) != sizeof(batch) || batch > UPGRADE_FD_BATCH ||
+            received + (int)batch > count) {
+            perror("Failed to receive descriptors");
+            return -1;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * batch)) {
+            fprintf(stderr, "Descriptor batch is missing its rights message.\n");
+            return -1;
+        }
+        memcpy(fds + received, CMSG_DATA(cmsg), sizeof(int) * batch);
+        received += batch;
+    }
+    return 0;
+}
+
+int upgrade_listen(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Upgrade socket path too long: %s\n", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    upgrade_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (upgrade_fd < 0) {
+        perror("Upgrade socket creation failed");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(upgrade_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(upgrade_fd, 1) < 0) {
+        perror("Upgrade socket bind failed");
+        close(upgrade_fd);
+        upgrade_fd = -1;
+        return -1;
+    }
+
+    FD_SET(upgrade_fd, &all_fds);
+    if (upgrade_fd > max_fd) max_fd = upgrade_fd;
+    printf("Waiting for upgrades on %s\n", path);
+    return upgrade_fd;
+}
+
+static int add_fd(int *fds, int *count, int fd) {
+    if (*count >= UPGRADE_MAX_FDS) return -1;
+    fds[*count] = fd;
+    return (*count)++;
+}
+
+static int build_snapshot(SnapWriter *w, int *fds, int *fd_count, int server_fd) {
+    add_fd(fds, fd_count, server_fd);
+
+    int used = 0;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (players[i].sockfd != -1 || players[i].state != STATE_IDLE) used++;
+    }
+    snap_put_u32(w, used);
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        Player *player = &players[i];
+        if (player->sockfd == -1 && player->state == STATE_IDLE) continue;
+
+        snap_put_u32(w, i);
+        snapshot_put_player(w, player, player->sockfd != -1 ? add_fd(fds, fd_count, player->sockfd) : -1);
+    }
+
+    snap_put_u32(w, session_count);
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        GameSession *session = &sessions[i];
+        if (!session->players[0] && !session->players[1]) continue;
+
+        snap_put_u32(w, i);
+        int slot0 = session->players[0] ? (int)(session->players[0] - players) : -1;
+        int slot1 = session->players[1] ? (int)(session->players[1] - players) : -1;
+        snapshot_put_session(w, session, slot0, slot1);
+    }
+
+    for (int i = 0; i < MAX_BOTS; i++) {
+        Player *bot_player;
+        int peer_fd, joined, awaiting;
+        if (bot_seat_info(i, &bot_player, &peer_fd, &joined, &awaiting) < 0) continue;
+
+        snap_put_u32(w, 1);
+        snap_put_u32(w, (uint32_t)(bot_player - players));
+        snap_put_u32(w, (uint32_t)add_fd(fds, fd_count, peer_fd));
+        snap_put_u32(w, joined);
+        snap_put_u32(w, awaiting);
+    }
+    snap_put_u32(w, 0);
+
+    // Watchers with events still queued are not listed and close on exit
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        int fd;
+        GameSession *session;
+        if (spectator_info(i, &fd, &session) < 0) continue;
+
+        snap_put_u32(w, 1);
+        snap_put_u32(w, (uint32_t)add_fd(fds, fd_count, fd));
+        snap_put_u32(w, (uint32_t)(session - sessions));
+    }
+    snap_put_u32(w, 0);
+
+    return w->failed ? -1 : 0;
+}
+
+static void hand_off(int conn, int server_fd) {
+    long long start = monotonic_ns();
+    static int fds[UPGRADE_MAX_FDS];
+    int fd_count = 0;
+    SnapWriter w = {0};
+
+    // The successor opens the profile store once it has acked, and _exit skips
+    // the atexit drain; nothing is queued while the loop is in here
+    profile_flush();
+
+    snap_put_u32(&w, SNAPSHOT_VERSION);
+    if (build_snapshot(&w, fds, &fd_count, server_fd) < 0) {
+        printf("Upgrade aborted: snapshot failed.\n");
+        snap_free(&w);
+        return;
+    }
+
+    UpgradeHeader header = {UPGRADE_MAGIC, fd_count, (uint32_t)w.len, 0, start};
+    if (write_full(conn, &header, sizeof(header)) < 0 || send_fds(conn, fds, fd_count) < 0 ||
+        write_full(conn, w.data, w.len) < 0) {
+        printf("Upgrade aborted: transfer failed.\n");
+        snap_free(&w);
+        return;
+    }
+    snap_free(&w);
+
+    struct timeval timeout = {UPGRADE_ACK_TIMEOUT, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char ack = 0;
+    if (read_full(conn, &ack, 1) < 0 || ack != 'K') {
+        printf("Upgrade aborted: successor did not confirm. Continuing.\n");
+        return;
+    }
+
+    printf("Handed %d descriptors to the new process in %.2f ms. Exiting.\n",
+           fd_count, (monotonic_ns() - start) / 1e6);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+void upgrade_handle(fd_set *read_fds, int server_fd) {
+    if (upgrade_fd < 0 || !FD_ISSET(upgrade_fd, read_fds)) return;
+
+    int conn = accept(upgrade_fd, NULL, NULL);
+    if (conn < 0) {
+        perror("Upgrade accept failed");
+        return;
+    }
+
+    printf("New server binary connected. Handing over...\n");
+    hand_off(conn, server_fd);
+
+    // Still running means the upgrade failed; keep serving from this process
+    close(conn);
+}
+
+void register_inherited_fd(int fd) {
+    FD_SET(fd, &all_fds);
+    if (fd > max_fd) max_fd = fd;
+
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr *)&peer, &len) == 0 && peer.sin_family == AF_INET) {
+        admission_accept(fd, peer.sin_addr.s_addr, 1);
+    }
+}
+
+static int restore_snapshot(SnapReader *r, const int *fds, int fd_count) {
+    if (snap_get_u32(r) != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Snapshot version mismatch.\n");
+        return -1;
+    }
+
+    uint32_t used = snap_get_u32(r);
+    for (uint32_t n = 0; n < used && !r->failed; n++) {
+        uint32_t slot = snap_get_u32(r);
+        if (slot >= MAX_PLAYERS) {
+            fprintf(stderr, "Player slot %u does not fit MAX_PLAYERS.\n", slot);
+            return -1;
+        }
+        int fd_index;
+        snapshot_get_player(r, &players[slot], &fd_index);
+        // A heartbeat in flight during the hand-off is forgiven; the next check sends a new one
+        players[slot].pendingHeartbeat = 0;
+        if (fd_index >= 0 && fd_index < fd_count) {
+            players[slot].sockfd = fds[fd_index];
+            register_inherited_fd(fds[fd_index]);
+        }
+        player_requeue_held(&players[slot]);
+    }
+
+    uint32_t count = snap_get_u32(r);
+    if (count > MAX_SESSIONS) {
+        fprintf(stderr, "%u sessions do not fit MAX_SESSIONS.\n", count);
+        return -1;
+    }
+    session_count = count;
+    for (uint32_t i = 0; i < count && !r->failed; i++) {
+        uint32_t index = snap_get_u32(r);
+        if (index >= MAX_SESSIONS) {
+            fprintf(stderr, "Session slot %u does not fit MAX_SESSIONS.\n", index);
+            return -1;
+        }
+        int slot0, slot1;
+        GameSession *session = &sessions[index];
+        snapshot_get_session(r, session, &slot0, &slot1);
+        session->players[0] = (slot0 >= 0 && slot0 < MAX_PLAYERS) ? &players[slot0] : NULL;
+        session->players[1] = (slot1 >= 0 && slot1 < MAX_PLAYERS) ? &players[slot1] : NULL;
+    }
+
+    while (!r->failed && snap_get_u32(r) == 1) {
+        uint32_t slot = snap_get_u32(r);
+        uint32_t peer_index = snap_get_u32(r);
+        int joined = (int)snap_get_u32(r);
+        int awaiting = (int)snap_get_u32(r);
+        if (slot >= MAX_PLAYERS || peer_index >= (uint32_t)fd_count) return -1;
+
+        if (bot_adopt(&players[slot], fds[peer_index], joined, awaiting) < 0) {
+            printf("Bots are disabled here. Ending the bot's game.\n");
+            close(fds[peer_index]);
+            disconnect_player(&players[slot]);
+        }
+    }
+
+    while (!r->failed && snap_get_u32(r) == 1) {
+        uint32_t fd_index = snap_get_u32(r);
+        uint32_t session_index = snap_get_u32(r);
+        if (fd_index >= (uint32_t)fd_count || session_index >= MAX_SESSIONS) return -1;
+
+        if (spectator_adopt(fds[fd_index], &sessions[session_index]) < 0) {
+            close(fds[fd_index]);
+        } else {
+            register_inherited_fd(fds[fd_index]);
+        }
+    }
+
+    return r->failed ? -1 : 0;
+}
+
+int upgrade_takeover(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Cannot reach the running server");
+        return -1;
+    }
+
+    UpgradeHeader header;
+    if (read_full(sock, &header, sizeof(header)) < 0 || header.magic != UPGRADE_MAGIC ||
+        header.fdCount < 1 || header.fdCount > UPGRADE_MAX_FDS) {
+        fprintf(stderr, "Bad upgrade header.\n");
+        close(sock);
+        return -1;
+    }
+
+    static int fds[UPGRADE_MAX_FDS];
+    char *data = malloc(header.snapshotLen);
+    if (!data || recv_fds(sock, fds, header.fdCount) < 0 || read_full(sock, data, header.snapshotLen) < 0) {
+        fprintf(stderr, "Upgrade transfer failed.\n");
+        free(data);
+        close(sock);
+        return -1;
+    }
+
+    SnapReader reader = {data, header.snapshotLen, 0, 0};
+    if (restore_snapshot(&reader, fds, header.fdCount) < 0) {
+        fprintf(stderr, "Upgrade snapshot could not be restored.\n");
+        free(data);
+        close(sock);
+        return -1;
+    }
+    free(data);
+
+    // The listening socket is always the first descriptor
+    int server_fd = fds[0];
+    FD_SET(server_fd, &all_fds);
+    if (server_fd > max_fd) max_fd = server_fd;
+
+    if (write_full(sock, "K", 1) < 0) {
+        fprintf(stderr, "Could not confirm the upgrade.\n");
+    }
+    close(sock);
+
+    printf("Took over %u descriptors and %d sessions. Pause: %.2f ms.\n",
+           header.fdCount, session_count, (monotonic_ns() - header.startNs) / 1e6);
+    return server_fd;
+}
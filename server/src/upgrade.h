@@ -0,0 +1,23 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+#include <sys/select.h>
+
+#define UPGRADE_MAGIC 0x5055564B   // "KVUP"
+#define UPGRADE_FD_BATCH 200       // Below the kernel's SCM_MAX_FD of 253
+#define UPGRADE_ACK_TIMEOUT 5      // Seconds the old process waits for its successor
+#define UPGRADE_MAX_FDS 4096
+
+int upgrade_listen(const char *path);
+void upgrade_handle(fd_set *read_fds, int server_fd);
+int upgrade_takeover(const char *path);
+
+void register_inherited_fd(int fd);
+int send_fds(int sock, const int *fds, int count);
+int recv_fds(int sock, int *fds, int count);
+int read_full(int fd, void *data, size_t len);
+int write_full(int fd, const void *data, size_t len);
+long long monotonic_ns();
+
+#endif
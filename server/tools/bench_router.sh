@@ -0,0 +1,31 @@
+#!/bin/bash
+# Games per second through the router with 1, 2, 4... backends.
+# Usage: tools/bench_router.sh [seconds] [backend counts...]
+# Run from server/ after make. Each backend gets as many load clients as it has player slots.
+
+SECONDS_PER_RUN=${1:-10}
+shift
+COUNTS=${@:-1 2 4}
+PER_BACKEND=${PER_BACKEND:-10}
+PORT=${PORT:-9300}
+DIR=$(mktemp -d)
+
+for count in $COUNTS; do
+    pids=()
+    for i in $(seq 1 "$count"); do
+        ./server --no-check --rate 0 --backend-socket "$DIR/b$i.sock" 127.0.0.1 $((PORT + i)) > /dev/null 2>&1 &
+        pids+=($!)
+    done
+    ./router -d "$DIR" 127.0.0.1 "$PORT" > /dev/null 2>&1 &
+    pids+=($!)
+    sleep 1
+
+    printf "backends=%d " "$count"
+    ./loadgen -c $((count * PER_BACKEND)) -d "$SECONDS_PER_RUN" -t 127.0.0.1:"$PORT"
+
+    kill "${pids[@]}" 2> /dev/null
+    wait "${pids[@]}" 2> /dev/null
+    rm -f "$DIR"/*.sock
+done
+
+rmdir "$DIR"
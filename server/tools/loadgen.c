@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Load generator: N scripted clients play games back to back against each
+// other through the normal KIVUPS protocol and report throughput and
+// move latency. Each client plays the first legal card it holds.
+
+#define LG_BUFFER 8192
+#define LG_MAX_HAND 32
+#define LG_LATENCY_BUCKETS 2000   // 50 us buckets up to 100 ms
+
+typedef struct {
+    int fd;
+    int id;
+    char name[16];
+    char in[LG_BUFFER];
+    int inLen;
+    char hand[LG_MAX_HAND][16];
+    int handSize;
+    char activeSuit[16];
+    char activeValue[16];
+    int myTurn;
+    int skipPending;
+    int forcePending;
+    int waitingReply;          // A move is out, its answer not yet seen
+    long long moveSentNs;
+} Client;
+
+static const char *unix_path = NULL;
+static const char *server_path = NULL;    // -x: start this server on socketpairs
+static pid_t server_pid = -1;
+static struct sockaddr_in tcp_addr;
+static long long games = 0;
+static long long moves = 0;
+static long long invalid = 0;
+static long long latency[LG_LATENCY_BUCKETS + 1];
+static long long latency_count = 0;
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int open_connection() {
+    int fd;
+    if (unix_path) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) return -1;
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&tcp_addr, sizeof(tcp_addr)) < 0) return -1;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Each client gets one end of a socketpair, the server started here gets the
+// other through --client-fd. Options after -- go to the server.
+static int spawn_server(Client *clients, int count, char **server_args, int server_argc) {
+    char **argv = calloc(2 * count + server_argc + 2, sizeof(char *));
+    char (*numbers)[12] = calloc(count, sizeof(*numbers));
+    int *server_ends = calloc(count, sizeof(int));
+    if (!argv || !numbers || !server_ends) return -1;
+
+    int argc = 0;
+    argv[argc++] = (char *)server_path;
+    for (int i = 0; i < count; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) return -1;
+        fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+        clients[i].fd = pair[0];
+        server_ends[i] = pair[1];
+        snprintf(numbers[i], sizeof(numbers[i]), "%d", pair[1]);
+        argv[argc++] = "--client-fd";
+        argv[argc++] = numbers[i];
+    }
+    for (int i = 0; i < server_argc; i++) argv[argc++] = server_args[i];
+    argv[argc] = NULL;
+
+    server_pid = fork();
+    if (server_pid < 0) return -1;
+    if (server_pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+        execv(server_path, argv);
+        perror("loadgen exec");
+        _exit(127);
+    }
+
+    for (int i = 0; i < count; i++) close(server_ends[i]);
+    free(server_ends);
+    free(numbers);
+    free(argv);
+    return 0;
+}
+
+static void send_command(Client *client, const char *opcode, const char *data) {
+    char message[256];
+    int len;
+    if (data) {
+        len = snprintf(message, sizeof(message), "KIVUPS%s%04d%s%04d%s\n", opcode,
+                       (int)strlen(client->name), client->name, (int)strlen(data), data);
+    } else {
+        len = snprintf(message, sizeof(message), "KIVUPS%s%04d%s\n", opcode, (int)strlen(client->name), client->name);
+    }
+    if (send(client->fd, message, len, MSG_NOSIGNAL) != len) {
+        perror("loadgen send");
+    }
+}
+
+static void split_card(const char *card, char *suit, char *value) {
+    const char *sep = strchr(card, '_');
+    if (!sep) {
+        suit[0] = value[0] = '\0';
+        return;
+    }
+    snprintf(suit, 16, "%.*s", (int)(sep - card), card);
+    snprintf(value, 16, "%s", sep + 1);
+}
+
+static void remove_card(Client *client, const char *card) {
+    for (int i = 0; i < client->handSize; i++) {
+        if (strcmp(client->hand[i], card) == 0) {
+            memmove(client->hand[i], client->hand[i + 1], (client->handSize - i - 1) * sizeof(client->hand[0]));
+            client->handSize--;
+            return;
+        }
+    }
+}
+
+static void play_turn(Client *client) {
+    if (!client->myTurn || client->waitingReply) return;
+
+    const char *pick = NULL;
+    for (int i = 0; i < client->handSize && !pick; i++) {
+        char suit[16], value[16];
+        split_card(client->hand[i], suit, value);
+        if (client->skipPending) {
+            if (strcmp(value, "ace") == 0) pick = client->hand[i];
+        } else if (client->forcePending) {
+            if (strcmp(value, "7") == 0) pick = client->hand[i];
+        } else if (strcmp(suit, client->activeSuit) == 0 || strcmp(value, client->activeValue) == 0) {
+            pick = client->hand[i];
+        }
+    }
+
+    client->waitingReply = 1;
+    client->moveSentNs = now_ns();
+    moves++;
+    if (pick) {
+        send_command(client, "playCa", pick);
+    } else if (client->skipPending) {
+        send_command(client, "skipMv", NULL);
+    } else if (client->forcePending) {
+        send_command(client, "forceD", NULL);
+    } else {
+        send_command(client, "drawCa", NULL);
+    }
+}
+
+static void record_latency(Client *client) {
+    if (!client->waitingReply) return;
+    long long bucket = (now_ns() - client->moveSentNs) / 50000;
+    latency[bucket < LG_LATENCY_BUCKETS ? bucket : LG_LATENCY_BUCKETS]++;
+    latency_count++;
+    client->waitingReply = 0;
+}
+
+static void handle_line(Client *client, char *line) {
+    if (strncmp(line, "KIVUPSgameSt", 12) == 0) {
+        // KIVUPSgameSt0000P1:<hand>|D:<card>|O:<n>|T:<0/1>|<flags>
+        char *hand = strchr(line, ':');
+        char *discard = strstr(line, "|D:");
+        char *turn = strstr(line, "|T:");
+        if (!hand || !discard || !turn) return;
+
+        *discard = '\0';
+        client->handSize = 0;
+        for (char *card = strtok(hand + 1, ","); card && client->handSize < LG_MAX_HAND; card = strtok(NULL, ",")) {
+            snprintf(client->hand[client->handSize++], 16, "%s", card);
+        }
+        char *discard_end = strchr(discard + 3, '|');
+        if (discard_end) *discard_end = '\0';
+        split_card(discard + 3, client->activeSuit, client->activeValue);
+        client->myTurn = turn[3] == '1';
+        client->skipPending = strstr(turn, "SKIP_PENDING") != NULL;
+        client->forcePending = strstr(turn, "FORCE_DRAW_PENDING") != NULL;
+        client->waitingReply = 0;
+        play_turn(client);
+    } else if (strncmp(line, "KIVUPSHEARTBEAT", 15) == 0) {
+        send_command(client, "heartB", NULL);
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_VALID|", 24) == 0) {
+        char *card = line + 24;
+        char *end = strchr(card, '|');
+        if (end) *end = '\0';
+        record_latency(client);
+        remove_card(client, card);
+        split_card(card, client->activeSuit, client->activeValue);
+        client->skipPending = client->forcePending = 0;
+        if (strcmp(client->activeValue, "queen") == 0 && client->handSize > 0) {
+            send_command(client, "suitCh", client->activeSuit);
+        }
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_INVALID", 25) == 0) {
+        record_latency(client);
+        invalid++;
+        client->waitingReply = 1;
+        client->moveSentNs = now_ns();
+        send_command(client, client->skipPending ? "skipMv" : client->forcePending ? "forceD" : "drawCa", NULL);
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_UPDATE|", 25) == 0) {
+        split_card(line + 25, client->activeSuit, client->activeValue);
+    } else if (strncmp(line, "KIVUPSSUIT_UPDATE|", 18) == 0) {
+        snprintf(client->activeSuit, 16, "%s", line + 18);
+    } else if (strncmp(line, "KIVUPSDRAW_SUCCESS|", 19) == 0) {
+        record_latency(client);
+        if (client->handSize < LG_MAX_HAND) snprintf(client->hand[client->handSize++], 16, "%s", line + 19);
+    } else if (strncmp(line, "KIVUPSSKIP_PENDING", 18) == 0) {
+        client->skipPending = 1;
+    } else if (strncmp(line, "KIVUPSFORCEDRAW_PENDING", 23) == 0) {
+        client->forcePending = 1;
+    } else if (strncmp(line, "KIVUPSTURN_SWITCH|", 18) == 0) {
+        record_latency(client);
+        client->myTurn = line[18] == '1';
+        if (!client->myTurn) client->skipPending = client->forcePending = 0;
+        play_turn(client);
+    } else if (strncmp(line, "KIVUPSGAME_OVER", 15) == 0 || strncmp(line, "KIVUPSSESSION_TERMINATED", 24) == 0) {
+        if (line[6] == 'G' && strstr(line, "VICTORY")) games++;
+        client->myTurn = client->waitingReply = 0;
+        send_command(client, "enterQ", NULL);
+    }
+}
+
+static int handle_input(Client *client) {
+    ssize_t n = read(client->fd, client->in + client->inLen, sizeof(client->in) - client->inLen - 1);
+    if (n <= 0) return -1;
+    client->inLen += n;
+    client->in[client->inLen] = '\0';
+
+    char *start = client->in;
+    char *newline;
+    while ((newline = strchr(start, '\n')) != NULL) {
+        *newline = '\0';
+        handle_line(client, start);
+        start = newline + 1;
+    }
+    client->inLen -= start - client->in;
+    memmove(client->in, start, client->inLen);
+    return 0;
+}
+
+static double latency_percentile(double fraction) {
+    long long target = (long long)(latency_count * fraction);
+    long long seen = 0;
+    for (int i = 0; i <= LG_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen > target) return (i + 1) * 0.05;
+    }
+    return LG_LATENCY_BUCKETS * 0.05;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-p prefix] (-t ip:port | -u unix_path | -x server [-- options])\n"
+                    "-x starts the server itself and connects every client over a socketpair.\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    int client_count = 10;
+    int duration = 10;
+    const char *prefix = "lg";
+    const char *target = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:p:t:u:x:h")) != -1) {
+        switch (opt) {
+        case 'c': client_count = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'p': prefix = optarg; break;
+        case 't': target = optarg; break;
+        case 'u': unix_path = optarg; break;
+        case 'x': server_path = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!unix_path && !server_path) {
+        char host[64];
+        const char *colon = target ? strrchr(target, ':') : NULL;
+        if (!colon || colon - target >= (int)sizeof(host)) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+        tcp_addr.sin_family = AF_INET;
+        tcp_addr.sin_port = htons(atoi(colon + 1));
+        if (inet_pton(AF_INET, host, &tcp_addr.sin_addr) <= 0) {
+            fprintf(stderr, "Bad address %s\n", target);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Client *clients = calloc(client_count, sizeof(Client));
+    int epoll_fd = epoll_create1(0);
+    if (!clients || epoll_fd < 0) {
+        perror("loadgen setup");
+        return EXIT_FAILURE;
+    }
+
+    if (server_path && spawn_server(clients, client_count, argv + optind, argc - optind) < 0) {
+        perror("loadgen spawn");
+        return EXIT_FAILURE;
+    }
+
+    int connected = 0;
+    for (int i = 0; i < client_count; i++) {
+        Client *client = &clients[i];
+        client->id = i;
+        snprintf(client->name, sizeof(client->name), "%s%d", prefix, i);
+        if (!server_path) client->fd = open_connection();
+        if (client->fd < 0) {
+            fprintf(stderr, "Client %d could not connect: %s\n", i, strerror(errno));
+            continue;
+        }
+        struct epoll_event event = {EPOLLIN, {.ptr = client}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+        send_command(client, "enterQ", NULL);
+        connected++;
+    }
+
+    long long start = now_ns();
+    long long end = start + duration * 1000000000LL;
+    struct epoll_event events[256];
+
+    while (now_ns() < end && connected > 0) {
+        int n = epoll_wait(epoll_fd, events, 256, 100);
+        for (int i = 0; i < n; i++) {
+            Client *client = events[i].data.ptr;
+            if (handle_input(client) < 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+                close(client->fd);
+                client->fd = -1;
+                connected--;
+            }
+        }
+    }
+
+    double seconds = (now_ns() - start) / 1e9;
+    printf("clients=%d connected=%d seconds=%.1f games=%lld games/s=%.1f moves/s=%.0f invalid=%lld "
+           "latency_ms p50=%.2f p99=%.2f p999=%.2f\n",
+           client_count, connected, seconds, games, games / seconds, moves / seconds, invalid,
+           latency_percentile(0.50), latency_percentile(0.99), latency_percentile(0.999));
+
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i].fd >= 0) close(clients[i].fd);
+    }
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    free(clients);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Memory benchmark: starts a server, opens N idle connections and then M
+// games, and reports how much the server's resident set grew per unit.
+// Tables the server touches at startup do not grow the resident set, so the
+// bytes each unit reserves in them are read from the server's admin socket
+// (the sizes `upsctl memory` shows) and reported next to it. With -l / -L it
+// exits 1 when either figure of a unit exceeds the given bytes, so a change
+// that makes connections or games heavier shows up in a script.
+
+#define MB_BUFFER 4096
+
+static pid_t server_pid = -1;
+static char socket_path[108];
+static char admin_path[108];
+
+static long rss_kb(pid_t pid) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+    long kb = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(file);
+    return kb;
+}
+
+static int open_connection(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int spawn_server(const char *server, char **server_args, int server_argc) {
+    char **argv = calloc(server_argc + 10, sizeof(char *));
+    if (!argv) return -1;
+    int argc = 0;
+    argv[argc++] = (char *)server;
+    argv[argc++] = "--unix-socket";
+    argv[argc++] = socket_path;
+    argv[argc++] = "--admin-socket";
+    argv[argc++] = admin_path;
+    // Every connection comes from the same local peer
+    argv[argc++] = "--max-per-ip";
+    argv[argc++] = "0";
+    argv[argc++] = "--rate";
+    argv[argc++] = "0";
+    for (int i = 0; i < server_argc; i++) argv[argc++] = server_args[i];
+    argv[argc] = NULL;
+
+    server_pid = fork();
+    if (server_pid < 0) return -1;
+    if (server_pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+        execv(server, argv);
+        perror("membench exec");
+        _exit(127);
+    }
+    free(argv);
+
+    // Up once the socket accepts
+    for (int i = 0; i < 100; i++) {
+        int fd = open_connection(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        if (waitpid(server_pid, NULL, WNOHANG) == server_pid) return -1;
+        usleep(50000);
+    }
+    return -1;
+}
+
+static void send_command(int fd, const char *opcode, const char *name) {
+    char message[128];
+    int len = snprintf(message, sizeof(message), "KIVUPS%s%04d%s\n", opcode, (int)strlen(name), name);
+    if (send(fd, message, len, MSG_NOSIGNAL) != len) perror("membench send");
+}
+
+// Reads until a message starting with prefix arrives; -1 on close or after 10 s
+static int wait_for(int fd, const char *prefix) {
+    char in[MB_BUFFER];
+    int len = 0;
+    struct timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    for (;;) {
+        ssize_t got = recv(fd, in + len, sizeof(in) - 1 - len, 0);
+        if (got <= 0) return -1;
+        len += got;
+        in[len] = '\0';
+
+        char *start = in, *newline;
+        while ((newline = strchr(start, '\n'))) {
+            if (strncmp(start, prefix, strlen(prefix)) == 0) return 0;
+            start = newline + 1;
+        }
+        len -= start - in;
+        memmove(in, start, len);
+        if (len == (int)sizeof(in) - 1) len = 0;
+    }
+}
+
+// Per-unit table sizes from the admin `memory` answer, as built into this server
+static int read_static_sizes(long *connection, long *session) {
+    int fd = open_connection(admin_path);
+    if (fd < 0) return -1;
+    FILE *in = fdopen(fd, "r+");
+    if (!in) {
+        close(fd);
+        return -1;
+    }
+    fputs("memory\n", in);
+    fflush(in);
+
+    char line[256];
+    *connection = *session = -1;
+    while (fgets(line, sizeof(line), in) && strcmp(line, "END\n") != 0) {
+        sscanf(line, "connection bytes=%ld", connection);
+        sscanf(line, "session bytes=%ld", session);
+    }
+    fclose(in);
+    return *connection < 0 || *session < 0 ? -1 : 0;
+}
+
+static void stop_server() {
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    unlink(socket_path);
+    unlink(admin_path);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s -x server [-n idle_connections] [-m games] [-l max_bytes_per_connection]\n"
+                    "       [-L max_bytes_per_game] [-- options]\n"
+                    "The server needs at least n + 2m player slots and m sessions.\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *server = NULL;
+    int idle_count = 200;
+    int game_count = 100;
+    long max_connection = -1;
+    long max_game = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:n:m:l:L:h")) != -1) {
+        switch (opt) {
+        case 'x': server = optarg; break;
+        case 'n': idle_count = atoi(optarg); break;
+        case 'm': game_count = atoi(optarg); break;
+        case 'l': max_connection = atol(optarg); break;
+        case 'L': max_game = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!server || idle_count < 1 || game_count < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/membench-%d.sock", (int)getpid());
+    snprintf(admin_path, sizeof(admin_path), "/tmp/membench-%d.admin.sock", (int)getpid());
+    if (spawn_server(server, argv + optind, argc - optind) < 0) {
+        fprintf(stderr, "membench: server did not start\n");
+        stop_server();
+        return 1;
+    }
+
+    int *fds = calloc(idle_count + 2 * game_count, sizeof(int));
+    if (!fds) {
+        stop_server();
+        return 1;
+    }
+    usleep(200000);
+    long base = rss_kb(server_pid);
+
+    // A watch request for nobody is answered and leaves the player idle, so
+    // the answer proves the server has taken the connection in
+    int failed = 0;
+    for (int i = 0; i < idle_count && !failed; i++) {
+        fds[i] = open_connection(socket_path);
+        if (fds[i] < 0) failed = 1;
+        else send_command(fds[i], "watchG", "membench-nobody");
+    }
+    for (int i = 0; i < idle_count && !failed; i++) {
+        if (wait_for(fds[i], "KIVUPSSPECTATE_FAILED") < 0) failed = 1;
+    }
+    long idle = rss_kb(server_pid);
+
+    char name[16];
+    for (int i = idle_count; i < idle_count + 2 * game_count && !failed; i++) {
+        fds[i] = open_connection(socket_path);
+        if (fds[i] < 0) {
+            failed = 1;
+            break;
+        }
+        snprintf(name, sizeof(name), "mb%d", i);
+        send_command(fds[i], "enterQ", name);
+    }
+    for (int i = idle_count; i < idle_count + 2 * game_count && !failed; i++) {
+        if (wait_for(fds[i], "KIVUPSgameSt") < 0) failed = 1;
+    }
+    long playing = rss_kb(server_pid);
+
+    if (failed) {
+        fprintf(stderr, "membench: the server dropped or did not answer a connection (too few slots?)\n");
+        stop_server();
+        return 1;
+    }
+    long static_connection, static_session;
+    if (read_static_sizes(&static_connection, &static_session) < 0) {
+        fprintf(stderr, "membench: no memory answer from the admin socket\n");
+        stop_server();
+        return 1;
+    }
+    // A game holds two connections and a session
+    long static_game = 2 * static_connection + static_session;
+
+    double per_connection = (idle - base) * 1024.0 / idle_count;
+    double per_game = (playing - idle) * 1024.0 / game_count;
+    printf("rss_kb base=%ld idle=%ld games=%ld connections=%d games=%d bytes_per_connection=%.0f bytes_per_game=%.0f\n",
+           base, idle, playing, idle_count, game_count, per_connection, per_game);
+    printf("static bytes_per_connection=%ld bytes_per_game=%ld\n", static_connection, static_game);
+
+    // Stopped first so the server does not log every hang-up
+    stop_server();
+    for (int i = 0; i < idle_count + 2 * game_count; i++) close(fds[i]);
+    free(fds);
+
+    int over = 0;
+    if (max_connection >= 0 && per_connection > max_connection) {
+        fprintf(stderr, "membench: %.0f bytes per connection, limit %ld\n", per_connection, max_connection);
+        over = 1;
+    }
+    if (max_connection >= 0 && static_connection > max_connection) {
+        fprintf(stderr, "membench: %ld static bytes per connection, limit %ld\n", static_connection, max_connection);
+        over = 1;
+    }
+    if (max_game >= 0 && per_game > max_game) {
+        fprintf(stderr, "membench: %.0f bytes per game, limit %ld\n", per_game, max_game);
+        over = 1;
+    }
+    if (max_game >= 0 && static_game > max_game) {
+        fprintf(stderr, "membench: %ld static bytes per game, limit %ld\n", static_game, max_game);
+        over = 1;
+    }
+    return over;
+}
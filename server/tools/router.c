@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Front router: accepts player connections on TCP and relays each one over a
+// Unix socket to one of several server processes started with --backend-socket.
+// A player is placed on a backend when it enters the queue: the backend that
+// already has someone waiting wins, otherwise the least loaded one. Between
+// games a player can move to another backend the same way.
+
+#define ROUTER_MAX_BACKENDS 64
+#define ROUTER_BUFFER 65536         // Pending bytes per direction before a client is cut
+#define ROUTER_BUFFER_START 4096    // First allocation once a direction backs up
+#define ROUTER_LINE 512             // Longest command accepted from a client
+#define ROUTER_SCAN_INTERVAL 1      // Seconds between backend directory scans
+#define ROUTER_HEAD 16              // Bytes of each server line kept for inspection
+
+typedef struct Client Client;
+
+typedef struct {
+    char path[108];
+    int up;              // Connect works; cleared on failure until the next scan
+    int seen;            // Found by the current directory scan
+    int fixed;           // Given with -b, never dropped by a scan
+    int clients;         // Relayed connections currently open
+    Client *waiting;     // Router's view of the backend's queue
+    unsigned long routed;
+} Backend;
+
+typedef struct {
+    Client *client;
+    int upstream;        // 0 = player side, 1 = backend side
+} Endpoint;
+
+// Allocated only when a send backs up, so an idle connection costs no buffer
+typedef struct {
+    char *data;
+    int len;
+    int capacity;
+} OutBuffer;
+
+struct Client {
+    int fd;
+    int backendFd;
+    int backend;         // Index into backends, -1 before the first enterQ
+    int busy;            // Queued or playing; only an idle player can move
+    int watching;        // Spectators stay where the game is
+    char username[64];
+    char line[ROUTER_LINE];
+    int lineLen;
+    char head[ROUTER_HEAD];
+    int headLen;
+    OutBuffer toClient;
+    OutBuffer toBackend;
+    Endpoint clientEnd;
+    Endpoint backendEnd;
+    Client *nextFree;
+};
+
+static Backend backends[ROUTER_MAX_BACKENDS];
+static int backend_count = 0;
+static const char *backend_dir = NULL;
+static Client *clients;
+static Client *free_clients;
+static int epoll_fd;
+static int open_clients = 0;
+static volatile sig_atomic_t print_requested = 0;
+
+static void close_client(Client *client);
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int add_backend(const char *path, int fixed) {
+    for (int i = 0; i < backend_count; i++) {
+        if (strcmp(backends[i].path, path) == 0) {
+            backends[i].seen = 1;
+            return i;
+        }
+    }
+    // Reuse a slot of a backend that went away and has no clients left
+    int index = -1;
+    for (int i = 0; i < backend_count; i++) {
+        if (!backends[i].path[0] && backends[i].clients == 0) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        if (backend_count >= ROUTER_MAX_BACKENDS) {
+            fprintf(stderr, "Too many backends, ignoring %s\n", path);
+            return -1;
+        }
+        index = backend_count++;
+    }
+
+    Backend *backend = &backends[index];
+    memset(backend, 0, sizeof(*backend));
+    snprintf(backend->path, sizeof(backend->path), "%s", path);
+    backend->up = backend->seen = 1;
+    backend->fixed = fixed;
+    printf("Backend %d added: %s\n", index, path);
+    return index;
+}
+
+static void scan_backends() {
+    if (!backend_dir) return;
+
+    DIR *dir = opendir(backend_dir);
+    if (!dir) {
+        perror("opendir");
+        return;
+    }
+
+    for (int i = 0; i < backend_count; i++) {
+        backends[i].seen = backends[i].fixed;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 6 || strcmp(entry->d_name + len - 5, ".sock") != 0) continue;
+
+        char path[108];
+        if (snprintf(path, sizeof(path), "%s/%s", backend_dir, entry->d_name) >= (int)sizeof(path)) continue;
+        struct stat st;
+        if (stat(path, &st) < 0 || !S_ISSOCK(st.st_mode)) continue;
+
+        int index = add_backend(path, 0);
+        // A socket that reappears gets another chance
+        if (index >= 0) backends[index].up = 1;
+    }
+    closedir(dir);
+
+    for (int i = 0; i < backend_count; i++) {
+        if (backends[i].path[0] && !backends[i].seen) {
+            printf("Backend %d removed: %s\n", i, backends[i].path);
+            backends[i].path[0] = '\0';
+            backends[i].up = 0;
+            backends[i].waiting = NULL;
+        }
+    }
+}
+
+static int pick_backend(Client *client) {
+    // Pair with a waiting player first so both land in the same process,
+    // preferring one on the current backend. A waiter elsewhere always wins
+    // over staying: two waiters on different backends would never meet.
+    int current = client->backend;
+    if (current >= 0 && backends[current].up && backends[current].waiting &&
+        backends[current].waiting != client) {
+        return current;
+    }
+    for (int i = 0; i < backend_count; i++) {
+        if (backends[i].up && backends[i].waiting && backends[i].waiting != client) {
+            return i;
+        }
+    }
+
+    // Otherwise the least loaded, counting this player where it would end up;
+    // ties keep it where it is so players do not bounce between games
+    int best = -1;
+    int best_load = 0;
+    for (int i = 0; i < backend_count; i++) {
+        if (!backends[i].up) continue;
+        int load = backends[i].clients + (i != current);
+        if (best < 0 || load < best_load || (load == best_load && i == current)) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+static int connect_backend(int index) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", backends[index].path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Backend %d unreachable: %s\n", index, strerror(errno));
+        close(fd);
+        backends[index].up = 0;
+        return -1;
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+static void detach_backend(Client *client) {
+    if (client->backend < 0) return;
+
+    Backend *backend = &backends[client->backend];
+    if (backend->waiting == client) backend->waiting = NULL;
+    backend->clients--;
+    if (client->backendFd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->backendFd, NULL);
+        close(client->backendFd);
+    }
+    client->backendFd = -1;
+    client->backend = -1;
+    client->toBackend.len = 0;
+}
+
+static int attach_backend(Client *client) {
+    int index;
+    int fd = -1;
+    // Try backends until one accepts; failed ones are marked down
+    while ((index = pick_backend(client)) >= 0) {
+        if (index == client->backend) return 0;
+        fd = connect_backend(index);
+        if (fd >= 0) break;
+    }
+    if (fd < 0) return -1;
+
+    if (client->backend >= 0) {
+        printf("Moving %s from backend %d to %d between games.\n", client->username, client->backend, index);
+    }
+    detach_backend(client);
+
+    client->backend = index;
+    client->backendFd = fd;
+    backends[index].clients++;
+    backends[index].routed++;
+    struct epoll_event event = {EPOLLIN, {.ptr = &client->backendEnd}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    return 0;
+}
+
+static void update_events(Client *client) {
+    struct epoll_event event = {EPOLLIN | (client->toClient.len ? EPOLLOUT : 0), {.ptr = &client->clientEnd}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    if (client->backendFd >= 0) {
+        struct epoll_event up = {EPOLLIN | (client->toBackend.len ? EPOLLOUT : 0), {.ptr = &client->backendEnd}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->backendFd, &up);
+    }
+}
+
+// Writes what it can now and keeps the rest; returns -1 when the peer is gone or too slow
+static int queue_bytes(int fd, OutBuffer *out, const char *data, int len) {
+    if (out->len == 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (n > 0) {
+            data += n;
+            len -= n;
+        }
+    }
+    if (len == 0) return 0;
+    if (out->len + len > ROUTER_BUFFER) return -1;
+    if (out->len + len > out->capacity) {
+        int capacity = out->capacity ? out->capacity : ROUTER_BUFFER_START;
+        while (capacity < out->len + len) capacity *= 2;
+        if (capacity > ROUTER_BUFFER) capacity = ROUTER_BUFFER;
+        char *grown = realloc(out->data, capacity);
+        if (!grown) return -1;
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return 0;
+}
+
+static int flush_bytes(int fd, OutBuffer *out) {
+    if (out->len == 0) return 0;
+    ssize_t n = send(fd, out->data, out->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    out->len -= n;
+    memmove(out->data, out->data + n, out->len);
+    return 0;
+}
+
+static void free_out_buffer(OutBuffer *out) {
+    free(out->data);
+    out->data = NULL;
+    out->len = out->capacity = 0;
+}
+
+static Client *find_player(const char *username) {
+    for (Client *client = clients; client < clients + open_clients; client++) {
+        if (client->fd >= 0 && client->backend >= 0 && strcmp(client->username, username) == 0) return client;
+    }
+    return NULL;
+}
+
+static void read_username(const char *line, char *out, int size) {
+    // KIVUPS<opcode><len:4><name>...
+    int len = atoi(line + 12);
+    if (len < 0 || len >= size || (int)strlen(line) < 16 + len) len = 0;
+    memcpy(out, line + 16, len);
+    out[len] = '\0';
+}
+
+static int route_line(Client *client, char *line, int len) {
+    if (len < 12 || strncmp(line, "KIVUPS", 6) != 0) return -1;
+
+    if (strncmp(line + 6, "enterQ", 6) == 0) {
+        if (!client->username[0]) read_username(line, client->username, sizeof(client->username));
+        if (!client->busy && !client->watching) {
+            if (attach_backend(client) < 0) {
+                queue_bytes(client->fd, &client->toClient, "KIVUPSSERVER_BUSY\n", 18);
+                return -1;
+            }
+            Backend *backend = &backends[client->backend];
+            if (backend->waiting && backend->waiting != client) {
+                backend->waiting = NULL;
+            } else {
+                backend->waiting = client;
+            }
+            client->busy = 1;
+        }
+    } else if (strncmp(line + 6, "watchG", 6) == 0 && client->backend < 0) {
+        char target[64];
+        read_username(line, target, sizeof(target));
+        Client *player = find_player(target);
+        int fd = player ? connect_backend(player->backend) : -1;
+        if (fd < 0) {
+            queue_bytes(client->fd, &client->toClient, "KIVUPSSPECTATE_FAILED\n", 22);
+            return 0;
+        }
+        client->watching = 1;
+        client->backend = player->backend;
+        client->backendFd = fd;
+        backends[client->backend].clients++;
+        struct epoll_event event = {EPOLLIN, {.ptr = &client->backendEnd}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    } else if (client->backend < 0) {
+        // Nothing to relay to yet; heartbeats are only sent to players in a game
+        return strncmp(line + 6, "heartB", 6) == 0 ? 0 : -1;
+    }
+
+    line[len] = '\n';
+    return queue_bytes(client->backendFd, &client->toBackend, line, len + 1);
+}
+
+static int handle_client_input(Client *client) {
+    char data[4096];
+    ssize_t n = read(client->fd, data, sizeof(data));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n <= 0) return -1;
+
+    for (ssize_t i = 0; i < n; i++) {
+        if (data[i] != '\n') {
+            if (client->lineLen >= ROUTER_LINE - 1) return -1;
+            client->line[client->lineLen++] = data[i];
+            continue;
+        }
+        client->line[client->lineLen] = '\0';
+        if (route_line(client, client->line, client->lineLen) < 0) return -1;
+        client->lineLen = 0;
+    }
+    return 0;
+}
+
+static void inspect_server_line(Client *client) {
+    // Only the start of each line matters: game start and end move the player
+    Backend *backend = &backends[client->backend];
+    if (client->headLen >= 12 && strncmp(client->head, "KIVUPSgameSt", 12) == 0) {
+        if (backend->waiting == client) backend->waiting = NULL;
+    } else if (client->headLen >= 15 && (strncmp(client->head, "KIVUPSGAME_OVER", 15) == 0 ||
+                                         strncmp(client->head, "KIVUPSSESSION_T", 15) == 0)) {
+        client->busy = 0;
+    }
+}
+
+static int handle_backend_input(Client *client) {
+    char data[16384];
+    ssize_t n = read(client->backendFd, data, sizeof(data));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n <= 0) return -1;
+
+    for (ssize_t i = 0; i < n; i++) {
+        if (data[i] == '\n') {
+            inspect_server_line(client);
+            client->headLen = 0;
+        } else if (client->headLen < ROUTER_HEAD) {
+            client->head[client->headLen++] = data[i];
+        }
+    }
+    return queue_bytes(client->fd, &client->toClient, data, n);
+}
+
+static void accept_client(int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    if (!free_clients) {
+        send(fd, "KIVUPSSERVER_BUSY\n", 18, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+        return;
+    }
+
+    Client *client = free_clients;
+    free_clients = client->nextFree;
+    // Only the header is reset; line and head are written before they are read
+    client->fd = fd;
+    client->backendFd = -1;
+    client->backend = -1;
+    client->busy = 0;
+    client->watching = 0;
+    client->username[0] = '\0';
+    client->lineLen = 0;
+    client->headLen = 0;
+    client->toClient.len = 0;
+    client->toBackend.len = 0;
+    client->clientEnd = (Endpoint){client, 0};
+    client->backendEnd = (Endpoint){client, 1};
+    set_nonblocking(fd);
+    // Relayed chunks are already whole messages, holding them back only adds latency
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct epoll_event event = {EPOLLIN, {.ptr = &client->clientEnd}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (client - clients >= open_clients) open_clients = client - clients + 1;
+}
+
+static void close_client(Client *client) {
+    if (client->fd < 0) return;
+    // Best effort: the last words of the server (GAME_OVER, SERVER_BUSY) still go out
+    flush_bytes(client->fd, &client->toClient);
+    detach_backend(client);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    free_out_buffer(&client->toClient);
+    free_out_buffer(&client->toBackend);
+    client->nextFree = free_clients;
+    free_clients = client;
+}
+
+static void print_backends() {
+    for (int i = 0; i < backend_count; i++) {
+        if (!backends[i].path[0]) continue;
+        printf("Backend %d %s: %s, %d clients, %lu routed%s\n", i, backends[i].path,
+               backends[i].up ? "up" : "down", backends[i].clients, backends[i].routed,
+               backends[i].waiting ? ", 1 waiting" : "");
+    }
+    fflush(stdout);
+}
+
+static void request_print(int sig) {
+    (void)sig;
+    print_requested = 1;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-b backend.sock]... [-d backend_dir] [-m max_clients] ip port\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    int max_clients = 4096;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:m:h")) != -1) {
+        switch (opt) {
+        case 'b': add_backend(optarg, 1); break;
+        case 'd': backend_dir = optarg; break;
+        case 'm': max_clients = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || max_clients <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, request_print);
+
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &address.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid address %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        perror("Router listen failed");
+        return EXIT_FAILURE;
+    }
+
+    clients = calloc(max_clients, sizeof(Client));
+    epoll_fd = epoll_create1(0);
+    if (!clients || epoll_fd < 0) {
+        perror("Router setup failed");
+        return EXIT_FAILURE;
+    }
+    for (int i = max_clients - 1; i >= 0; i--) {
+        clients[i].fd = -1;
+        clients[i].nextFree = free_clients;
+        free_clients = &clients[i];
+    }
+
+    struct epoll_event event = {EPOLLIN, {.ptr = NULL}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    scan_backends();
+    printf("Router listening on %s:%s with %d backends.\n", argv[optind], argv[optind + 1], backend_count);
+    fflush(stdout);
+
+    time_t last_scan = time(NULL);
+    struct epoll_event events[256];
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, 256, 1000);
+
+        for (int i = 0; i < n; i++) {
+            Endpoint *end = events[i].data.ptr;
+            if (!end) {
+                accept_client(listen_fd);
+                continue;
+            }
+
+            Client *client = end->client;
+            if (client->fd < 0) continue;   // Closed earlier in this batch
+
+            int failed = 0;
+            if (events[i].events & EPOLLOUT) {
+                failed = end->upstream ? flush_bytes(client->backendFd, &client->toBackend)
+                                       : flush_bytes(client->fd, &client->toClient);
+            }
+            if (!failed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                failed = end->upstream ? handle_backend_input(client) : handle_client_input(client);
+            }
+
+            if (failed) {
+                close_client(client);
+            } else {
+                update_events(client);
+            }
+        }
+
+        if (time(NULL) - last_scan >= ROUTER_SCAN_INTERVAL) {
+            last_scan = time(NULL);
+            scan_backends();
+        }
+        if (print_requested) {
+            print_requested = 0;
+            print_backends();
+        }
+    }
+}
@@ -0,0 +1,682 @@
+#define _GNU_SOURCE
+#include "game.h"
+#include "player.h"
+#include "network.h"
+#include "admission.h"
+#include "recorder.h"
+#include "spectator.h"
+#include "config.h"
+#include "output.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// Deterministic network simulation: the server's game, player, admission
+// and heartbeat code runs unchanged against scripted clients, but sockets
+// are in-memory queues and time is a virtual clock. A seeded scheduler
+// decides every latency, think time, disconnect and silence, so hours of
+// play run in seconds and the same seed replays the same run byte for
+// byte. send(), close(), fcntl(), time() and clock_gettime() below replace
+// the libc versions for everything linked into this binary.
+
+#define SIM_FIRST_FD 16           // Fake descriptors stay below FD_SETSIZE
+#define SIM_INBOX 65536
+#define SIM_MAX_HAND 32
+
+typedef enum {
+    EV_CONNECT,
+    EV_TO_SERVER,       // A client's command arrives at the server
+    EV_TO_CLIENT,       // Everything the server sent so far arrives at a client
+    EV_MOVE,            // A client finished thinking
+    EV_REQUEUE,
+    EV_SILENCE,         // A client stops answering, heartbeats included
+    EV_CLOSE,           // A client closes its connection
+    EV_HEARTBEAT_CHECK,
+    EV_CLIENT_MONITOR,  // Every client's connection monitor, as in the Java client
+    EV_AUDIT
+} EventKind;
+
+typedef struct {
+    long long time;     // Virtual microseconds
+    unsigned long seq;  // Ties run in scheduling order
+    EventKind kind;
+    int client;
+    unsigned generation;
+    char *data;
+} Event;
+
+typedef struct {
+    int fd;             // -1 while not connected
+    int slot;
+    unsigned generation;  // Bumped on every new connection; stale events are dropped
+    char name[16];
+    long long latencyUs;
+    long long lastArrival;  // Commands on one connection arrive in order
+    long long lastMessage;  // Last line from the server; the real client hangs up after CLIENT_TIMEOUT_MS
+    int silent;
+    int deliveryPending;
+    char in[SIM_INBOX];
+    int inLen;
+    char hand[SIM_MAX_HAND][16];
+    int handSize;
+    char activeSuit[16];
+    char activeValue[16];
+    int myTurn;
+    int skipPending;
+    int forcePending;
+    int waitingReply;
+    int movePending;
+} SimClient;
+
+typedef struct {
+    unsigned long events;
+    unsigned long connects;
+    unsigned long busy;
+    unsigned long games;
+    unsigned long moves;
+    unsigned long invalid;
+    unsigned long heartbeats;
+    unsigned long closes;
+    unsigned long silences;
+    unsigned long serverCloses;
+    unsigned long clientTimeouts;
+    unsigned long checkFailures;
+    unsigned long countMismatches;
+    long long firstFailureUs;
+} SimStats;
+
+// Server globals normally defined in main.c
+fd_set all_fds;
+int max_fd;
+int session_count = 0;
+
+static long long virtual_us = 0;
+static const time_t epoch = 1700000000;   // Wall clock at virtual time zero
+static Event *heap;
+static int heap_len = 0;
+static int heap_cap = 0;
+static unsigned long next_seq = 0;
+static uint64_t rng_state;
+static SimClient *clients;
+static int client_count = 200;
+static int fd_client[FD_SETSIZE];         // Client on a fake descriptor, -1 when closed
+static int free_fds[FD_SETSIZE];
+static int free_fd_count = 0;
+static SimStats stats;
+static uint64_t digest = 14695981039346656037ULL;
+static FILE *report;
+
+// Scenario knobs
+static double close_chance = 0.05;    // Per game
+static double silence_chance = 0.02;  // Per game
+static int max_latency_ms = 40;
+static int max_think_ms = 1500;
+
+static uint64_t next_random() {
+    // splitmix64
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static long long random_between(long long low, long long high) {
+    return low + (long long)(next_random() % (uint64_t)(high - low + 1));
+}
+
+static int chance(double probability) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+static void mix_digest(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        digest = (digest ^ bytes[i]) * 1099511628211ULL;
+    }
+}
+
+// ---- Virtual clock and in-memory transport ----
+
+time_t time(time_t *out) {
+    time_t now = epoch + virtual_us / 1000000;
+    if (out) *out = now;
+    return now;
+}
+
+int clock_gettime(clockid_t clock, struct timespec *ts) {
+    long long us = virtual_us + (clock == CLOCK_REALTIME || clock == CLOCK_REALTIME_COARSE ? epoch * 1000000LL : 0);
+    ts->tv_sec = us / 1000000;
+    ts->tv_nsec = us % 1000000 * 1000;
+    return 0;
+}
+
+static int is_fake(int fd) {
+    return fd >= SIM_FIRST_FD && fd < FD_SETSIZE;
+}
+
+static void schedule(long long delay_us, EventKind kind, int client, char *data) {
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = realloc(heap, heap_cap * sizeof(Event));
+        if (!heap) {
+            perror("simnet");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Event event = {virtual_us + delay_us, next_seq++, kind, client, client >= 0 ? clients[client].generation : 0, data};
+    int i = heap_len++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        Event *p = &heap[parent];
+        if (p->time < event.time || (p->time == event.time && p->seq < event.seq)) break;
+        heap[i] = *p;
+        i = parent;
+    }
+    heap[i] = event;
+}
+
+static Event pop_event() {
+    Event top = heap[0];
+    Event last = heap[--heap_len];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= heap_len) break;
+        if (child + 1 < heap_len &&
+            (heap[child + 1].time < heap[child].time ||
+             (heap[child + 1].time == heap[child].time && heap[child + 1].seq < heap[child].seq))) {
+            child++;
+        }
+        if (last.time < heap[child].time || (last.time == heap[child].time && last.seq < heap[child].seq)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+ssize_t send(int fd, const void *data, size_t len, int flags) {
+    (void)flags;
+    if (!is_fake(fd) || fd_client[fd] < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    SimClient *client = &clients[fd_client[fd]];
+    if (client->inLen + (int)len > SIM_INBOX) {
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(client->in + client->inLen, data, len);
+    client->inLen += len;
+    mix_digest(&fd, sizeof(fd));
+    mix_digest(data, len);
+
+    if (!client->deliveryPending) {
+        client->deliveryPending = 1;
+        schedule(client->latencyUs, EV_TO_CLIENT, fd_client[fd], NULL);
+    }
+    return len;
+}
+
+int close(int fd) {
+    if (!is_fake(fd)) return syscall(SYS_close, fd);
+    if (fd_client[fd] < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // The server hung up; the client notices and comes back later
+    SimClient *client = &clients[fd_client[fd]];
+    stats.serverCloses++;
+    fd_client[fd] = -1;
+    free_fds[free_fd_count++] = fd;
+    client->fd = -1;
+    client->generation++;
+    schedule(random_between(1, 30) * 1000000LL, EV_CONNECT, client - clients, NULL);
+    return 0;
+}
+
+int fcntl(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    long arg = va_arg(args, long);
+    va_end(args);
+
+    if (!is_fake(fd)) return syscall(SYS_fcntl, fd, cmd, arg);
+    if (fd_client[fd] < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    return 0;
+}
+
+// ---- Scripted clients, the same strategy as loadgen ----
+
+static void client_send(SimClient *client, const char *opcode, const char *data) {
+    if (client->fd < 0 || client->silent) return;
+
+    char message[256];
+    if (data) {
+        snprintf(message, sizeof(message), "KIVUPS%s%04d%s%04d%s\n", opcode,
+                 (int)strlen(client->name), client->name, (int)strlen(data), data);
+    } else {
+        snprintf(message, sizeof(message), "KIVUPS%s%04d%s\n", opcode, (int)strlen(client->name), client->name);
+    }
+
+    long long arrival = virtual_us + client->latencyUs;
+    if (arrival <= client->lastArrival) arrival = client->lastArrival + 1;
+    client->lastArrival = arrival;
+    schedule(arrival - virtual_us, EV_TO_SERVER, client - clients, strdup(message));
+}
+
+static void split_card(const char *card, char *suit, char *value) {
+    const char *sep = strchr(card, '_');
+    if (!sep) {
+        suit[0] = value[0] = '\0';
+        return;
+    }
+    snprintf(suit, 16, "%.*s", (int)(sep - card), card);
+    snprintf(value, 16, "%s", sep + 1);
+}
+
+static void remove_card(SimClient *client, const char *card) {
+    for (int i = 0; i < client->handSize; i++) {
+        if (strcmp(client->hand[i], card) == 0) {
+            memmove(client->hand[i], client->hand[i + 1], (client->handSize - i - 1) * sizeof(client->hand[0]));
+            client->handSize--;
+            return;
+        }
+    }
+}
+
+static void think(SimClient *client) {
+    if (!client->myTurn || client->waitingReply || client->movePending) return;
+    client->movePending = 1;
+    schedule(random_between(20, max_think_ms) * 1000LL, EV_MOVE, client - clients, NULL);
+}
+
+static void play_turn(SimClient *client) {
+    client->movePending = 0;
+    if (!client->myTurn || client->waitingReply) return;
+
+    const char *pick = NULL;
+    for (int i = 0; i < client->handSize && !pick; i++) {
+        char suit[16], value[16];
+        split_card(client->hand[i], suit, value);
+        if (client->skipPending) {
+            if (strcmp(value, "ace") == 0) pick = client->hand[i];
+        } else if (client->forcePending) {
+            if (strcmp(value, "7") == 0) pick = client->hand[i];
+        } else if (strcmp(suit, client->activeSuit) == 0 || strcmp(value, client->activeValue) == 0) {
+            pick = client->hand[i];
+        }
+    }
+
+    client->waitingReply = 1;
+    stats.moves++;
+    if (pick) {
+        client_send(client, "playCa", pick);
+    } else {
+        client_send(client, client->skipPending ? "skipMv" : client->forcePending ? "forceD" : "drawCa", NULL);
+    }
+}
+
+static void start_faults(SimClient *client) {
+    // Decided when a game starts, so faults hit games in every phase
+    if (chance(close_chance)) {
+        schedule(random_between(1, 120) * 1000000LL, EV_CLOSE, client - clients, NULL);
+    } else if (chance(silence_chance)) {
+        schedule(random_between(1, 120) * 1000000LL, EV_SILENCE, client - clients, NULL);
+    }
+}
+
+static void handle_line(SimClient *client, char *line) {
+    if (strncmp(line, "KIVUPSgameSt", 12) == 0) {
+        char *hand = strchr(line, ':');
+        char *discard = strstr(line, "|D:");
+        char *turn = strstr(line, "|T:");
+        if (!hand || !discard || !turn) return;
+
+        *discard = '\0';
+        client->handSize = 0;
+        for (char *card = strtok(hand + 1, ","); card && client->handSize < SIM_MAX_HAND; card = strtok(NULL, ",")) {
+            snprintf(client->hand[client->handSize++], 16, "%s", card);
+        }
+        char *discard_end = strchr(discard + 3, '|');
+        if (discard_end) *discard_end = '\0';
+        split_card(discard + 3, client->activeSuit, client->activeValue);
+        client->myTurn = turn[3] == '1';
+        client->skipPending = strstr(turn, "SKIP_PENDING") != NULL;
+        client->forcePending = strstr(turn, "FORCE_DRAW_PENDING") != NULL;
+        client->waitingReply = 0;
+        start_faults(client);
+        think(client);
+    } else if (strncmp(line, "KIVUPSHEARTBEAT", 15) == 0) {
+        stats.heartbeats++;
+        client_send(client, "heartB", NULL);
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_VALID|", 24) == 0) {
+        char *card = line + 24;
+        char *end = strchr(card, '|');
+        if (end) *end = '\0';
+        client->waitingReply = 0;
+        remove_card(client, card);
+        split_card(card, client->activeSuit, client->activeValue);
+        client->skipPending = client->forcePending = 0;
+        if (strcmp(client->activeValue, "queen") == 0 && client->handSize > 0) {
+            client_send(client, "suitCh", client->activeSuit);
+        }
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_INVALID", 25) == 0) {
+        // The client only plays cards it believes are legal
+        stats.invalid++;
+        client_send(client, client->skipPending ? "skipMv" : client->forcePending ? "forceD" : "drawCa", NULL);
+    } else if (strncmp(line, "KIVUPSCARD_PLAYED_UPDATE|", 25) == 0) {
+        split_card(line + 25, client->activeSuit, client->activeValue);
+    } else if (strncmp(line, "KIVUPSSUIT_UPDATE|", 18) == 0) {
+        snprintf(client->activeSuit, 16, "%s", line + 18);
+    } else if (strncmp(line, "KIVUPSDRAW_SUCCESS|", 19) == 0) {
+        if (client->handSize < SIM_MAX_HAND) snprintf(client->hand[client->handSize++], 16, "%s", line + 19);
+    } else if (strncmp(line, "KIVUPSSKIP_PENDING", 18) == 0) {
+        client->skipPending = 1;
+    } else if (strncmp(line, "KIVUPSFORCEDRAW_PENDING", 23) == 0) {
+        client->forcePending = 1;
+    } else if (strncmp(line, "KIVUPSTURN_SWITCH|", 18) == 0) {
+        client->waitingReply = 0;
+        client->myTurn = line[18] == '1';
+        if (!client->myTurn) client->skipPending = client->forcePending = 0;
+        think(client);
+    } else if (strncmp(line, "KIVUPSGAME_OVER", 15) == 0 || strncmp(line, "KIVUPSSESSION_TERMINATED", 24) == 0) {
+        if (line[6] == 'G' && strstr(line, "VICTORY")) stats.games++;
+        client->myTurn = client->waitingReply = 0;
+        schedule(random_between(100, 5000) * 1000LL, EV_REQUEUE, client - clients, NULL);
+    } else if (strncmp(line, "KIVUPSOPPONENT_DISCONNECTED", 27) == 0) {
+        // The server has no way back into the game; give up after a while
+        client->myTurn = 0;
+        schedule(random_between(5, 30) * 1000000LL, EV_CLOSE, client - clients, NULL);
+    }
+}
+
+static void deliver_to_client(SimClient *client) {
+    client->deliveryPending = 0;
+    if (client->silent) {
+        client->inLen = 0;
+        return;
+    }
+
+    char *start = client->in;
+    char *newline;
+    while ((newline = memchr(start, '\n', client->inLen - (start - client->in))) != NULL) {
+        *newline = '\0';
+        client->lastMessage = virtual_us;
+        handle_line(client, start);
+        start = newline + 1;
+    }
+    client->inLen -= start - client->in;
+    memmove(client->in, start, client->inLen);
+}
+
+// ---- Server side, what main.c does with a real socket ----
+
+static void connect_client(SimClient *client) {
+    if (client->fd >= 0) return;
+    if (free_fd_count == 0) {
+        schedule(1000000, EV_CONNECT, client - clients, NULL);
+        return;
+    }
+
+    int fd = free_fds[--free_fd_count];
+    fd_client[fd] = client - clients;
+    client->fd = fd;
+    client->silent = 0;
+    // A delivery scheduled for the last connection was dropped with its generation
+    client->deliveryPending = 0;
+    client->inLen = 0;
+    client->handSize = 0;
+    client->myTurn = client->waitingReply = client->movePending = 0;
+    client->lastArrival = virtual_us;
+    client->lastMessage = virtual_us;
+    stats.connects++;
+
+    int slot = -1;
+    for (int i = 0; i < config()->maxPlayers; i++) {
+        if (players[i].sockfd == -1 && players[i].state != STATE_DISCONNECTED) {
+            slot = i;
+            break;
+        }
+    }
+    uint32_t ip = 0x0A000000 | (uint32_t)(client - clients);
+    if (admission_accept(fd, ip, slot >= 0) != ADMIT_OK) {
+        stats.busy++;
+        send(fd, "KIVUPSSERVER_BUSY\n", 18, MSG_NOSIGNAL);
+        close(fd);
+        return;
+    }
+
+    client->slot = slot;
+    players[slot].sockfd = fd;
+    FD_SET(fd, &all_fds);
+    if (fd > max_fd) max_fd = fd;
+    client_send(client, "enterQ", NULL);
+}
+
+static void deliver_to_server(SimClient *client, const char *message) {
+    Player *player = &players[client->slot];
+    if (client->fd < 0 || player->sockfd != client->fd) return;
+
+    GameSession *session = find_session_by_username(player->username);
+    handle_player_message(player, message, strlen(message));
+    scheduler_run();
+    if (session && session->players[0] && session->players[1] && recorder_check(session) < 0) {
+        if (!stats.checkFailures++) stats.firstFailureUs = virtual_us;
+    }
+}
+
+static void close_client(SimClient *client) {
+    if (client->fd < 0) return;
+    stats.closes++;
+    Player *player = &players[client->slot];
+    if (player->sockfd == client->fd) {
+        handle_connection_closed(player);
+    }
+}
+
+static void monitor_clients() {
+    // Silent clients stand for frozen ones, whose monitor does not run either
+    for (int i = 0; i < client_count; i++) {
+        SimClient *client = &clients[i];
+        if (client->fd >= 0 && !client->silent && virtual_us - client->lastMessage > CLIENT_TIMEOUT_MS * 1000LL) {
+            stats.clientTimeouts++;
+            close_client(client);
+        }
+    }
+    schedule(1000000, EV_CLIENT_MONITOR, -1, NULL);
+}
+
+static void audit() {
+    // Sessions counted by the server against the table itself
+    int live = 0;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].players[0] || sessions[i].players[1]) live++;
+    }
+    if (live != session_count) {
+        if (!stats.countMismatches++) {
+            fprintf(report, "t=%.3fs session_count=%d but %d sessions in use\n", virtual_us / 1e6, session_count, live);
+        }
+        if (!stats.checkFailures++) stats.firstFailureUs = virtual_us;
+    }
+    schedule(10000000, EV_AUDIT, -1, NULL);
+}
+
+static void run_event(Event *event) {
+    SimClient *client = event->client >= 0 ? &clients[event->client] : NULL;
+    if (client && event->kind != EV_CONNECT && event->generation != client->generation) {
+        free(event->data);
+        return;
+    }
+
+    switch (event->kind) {
+    case EV_CONNECT:
+        connect_client(client);
+        break;
+    case EV_TO_SERVER:
+        deliver_to_server(client, event->data);
+        break;
+    case EV_TO_CLIENT:
+        deliver_to_client(client);
+        break;
+    case EV_MOVE:
+        play_turn(client);
+        break;
+    case EV_REQUEUE:
+        client_send(client, "enterQ", NULL);
+        break;
+    case EV_SILENCE:
+        stats.silences++;
+        client->silent = 1;
+        schedule(random_between(10, 180) * 1000000LL, EV_CLOSE, event->client, NULL);
+        break;
+    case EV_CLOSE:
+        close_client(client);
+        break;
+    case EV_HEARTBEAT_CHECK:
+        check_player_activity();
+        handle_flagged_players();
+        schedule(config()->heartbeatIntervalMs * 1000LL, EV_HEARTBEAT_CHECK, -1, NULL);
+        break;
+    case EV_CLIENT_MONITOR:
+        monitor_clients();
+        break;
+    case EV_AUDIT:
+        audit();
+        break;
+    }
+    free(event->data);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-s seed] [-c clients] [-t seconds] [-x close_chance] [-z silence_chance]\n"
+            "          [-l max_latency_ms] [-k max_think_ms] [-C config] [-o flight_dir] [-v]\n"
+            "Plays -t seconds of virtual time with -c clients (at most %d) against the\n"
+            "server logic. -v shows the server log.\n",
+            name, MAX_PLAYERS);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long seed = 1;
+    double seconds = 3600;
+    const char *config_path = NULL;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:t:x:z:l:k:C:o:vh")) != -1) {
+        switch (opt) {
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 'c': client_count = atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'x': close_chance = atof(optarg); break;
+        case 'z': silence_chance = atof(optarg); break;
+        case 'l': max_latency_ms = atoi(optarg); break;
+        case 'k': max_think_ms = atoi(optarg); break;
+        case 'C': config_path = optarg; break;
+        case 'o': recorder_dir = optarg; break;
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (client_count < 2 || client_count > MAX_PLAYERS || client_count > FD_SETSIZE - SIM_FIRST_FD ||
+        max_latency_ms < 1 || max_think_ms < 20) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The server logs to stdout; the report goes to the original stdout
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!verbose) {
+        config_override("log-level", "info");
+        if (!freopen("/dev/null", "w", stdout)) perror("/dev/null");
+    }
+    config_override("max-per-ip", "0");
+    config_override("rate", "0");
+    // Round trips are measured on the real clock, which would break replay
+    config_override("rtt-match-wait", "0");
+    if (config_load(config_path) < 0) return EXIT_FAILURE;
+
+    rng_state = seed;
+    srand((unsigned)seed);
+    FD_ZERO(&all_fds);
+    init_players();
+    init_spectators();
+    output_init();
+    for (int fd = FD_SETSIZE - 1; fd >= SIM_FIRST_FD; fd--) {
+        fd_client[fd] = -1;
+        free_fds[free_fd_count++] = fd;
+    }
+    for (int i = 0; i < SIM_FIRST_FD; i++) fd_client[i] = -1;
+
+    clients = calloc(client_count, sizeof(SimClient));
+    if (!clients) {
+        perror("simnet");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < client_count; i++) {
+        clients[i].fd = -1;
+        snprintf(clients[i].name, sizeof(clients[i].name), "sim%d", i);
+        clients[i].latencyUs = random_between(1000, max_latency_ms * 1000LL);
+        schedule(random_between(0, 5000) * 1000LL, EV_CONNECT, i, NULL);
+    }
+    if (config()->heartbeatCheck) {
+        schedule(config()->heartbeatIntervalMs * 1000LL, EV_HEARTBEAT_CHECK, -1, NULL);
+    }
+    schedule(1000000, EV_CLIENT_MONITOR, -1, NULL);
+    schedule(10000000, EV_AUDIT, -1, NULL);
+
+    struct timeval wall_start, wall_end;
+    gettimeofday(&wall_start, NULL);
+    long long end_us = (long long)(seconds * 1e6);
+    while (heap_len > 0 && heap[0].time <= end_us) {
+        Event event = pop_event();
+        virtual_us = event.time;
+        stats.events++;
+        run_event(&event);
+        // One event is one iteration of the server's loop
+        output_flush_all();
+    }
+    gettimeofday(&wall_end, NULL);
+    fflush(stdout);
+
+    double wall = wall_end.tv_sec - wall_start.tv_sec + (wall_end.tv_usec - wall_start.tv_usec) / 1e6;
+    int live = 0;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].players[0] || sessions[i].players[1]) live++;
+    }
+    fprintf(report,
+            "seed=%llu clients=%d virtual=%.0fs wall=%.2fs speedup=%.0fx events=%lu\n"
+            "connects=%lu busy=%lu games=%lu moves=%lu invalid=%lu heartbeats=%lu\n"
+            "closes=%lu silences=%lu server_closes=%lu client_timeouts=%lu sessions_left=%d\n"
+            "messages=%lu writes=%lu\n"
+            "check_failures=%lu count_mismatches=%lu digest=%016llx\n",
+            seed, client_count, seconds, wall, wall > 0 ? seconds / wall : 0.0, stats.events,
+            stats.connects, stats.busy, stats.games, stats.moves, stats.invalid, stats.heartbeats,
+            stats.closes, stats.silences, stats.serverCloses, stats.clientTimeouts, live,
+            output_stats.messages, output_stats.writes,
+            stats.checkFailures, stats.countMismatches, (unsigned long long)digest);
+    if (stats.checkFailures) {
+        fprintf(report, "First failure at t=%.3fs. Replay with -s %llu.\n", stats.firstFailureUs / 1e6, seed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "rules.h"
+#include "montecarlo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+// Offline batch simulator: plays complete games with the server's rules on
+// every core and prints aggregate statistics once all threads are done.
+
+#define MAX_THREADS 256
+#define MAX_GAME_PLIES 2000
+#define LENGTH_BUCKET_WIDTH 8
+// Histogram of game length in plies, up to and including games cut at MAX_GAME_PLIES
+#define LENGTH_BUCKETS (MAX_GAME_PLIES / LENGTH_BUCKET_WIDTH + 1)
+
+typedef enum { POLICY_RANDOM, POLICY_GREEDY, POLICY_BOT } Policy;
+
+typedef struct {
+    uint64_t games;
+    uint64_t unfinished;
+    uint64_t firstPlayerWins;
+    uint64_t totalPlies;
+    uint64_t gamesWithReshuffle;
+    uint64_t reshuffles;
+    uint64_t gamesWithStackedSevens;
+    uint64_t stackedSevens;
+    uint64_t dryDraws;
+    uint64_t seatWins[2];        // Wins by policy slot, independent of who started
+    uint64_t lengths[LENGTH_BUCKETS];
+} SimStats;
+
+typedef struct {
+    pthread_t thread;
+    uint64_t games;
+    uint64_t seed;
+    SimStats stats;
+    char pad[64];                // Keep per-thread stats on separate cache lines
+} SimWorker;
+
+static Policy policies[2] = {POLICY_GREEDY, POLICY_GREEDY};
+static int bot_rollouts = 200;
+
+static int parse_policy(const char *name, Policy *policy) {
+    if (strcmp(name, "random") == 0) *policy = POLICY_RANDOM;
+    else if (strcmp(name, "greedy") == 0) *policy = POLICY_GREEDY;
+    else if (strcmp(name, "bot") == 0) *policy = POLICY_BOT;
+    else return -1;
+    return 0;
+}
+
+static const char *policy_name(Policy policy) {
+    return policy == POLICY_RANDOM ? "random" : policy == POLICY_GREEDY ? "greedy" : "bot";
+}
+
+static void choose_move(const CompactGame *game, Policy policy, RulesRng *rng, Move *move) {
+    switch (policy) {
+    case POLICY_RANDOM:
+        rules_random_move(game, rng, move);
+        break;
+    case POLICY_GREEDY:
+        rules_greedy_move(game, rng, move);
+        break;
+    case POLICY_BOT: {
+        MonteCarloStats stats;
+        // Rollout count, not time, bounds the bot so runs stay reproducible
+        mc_choose_move(game, rules_rng_next(rng), 1 << 30, bot_rollouts, move, &stats);
+        break;
+    }
+    }
+}
+
+static void *run_worker(void *arg) {
+    SimWorker *worker = arg;
+    SimStats *stats = &worker->stats;
+    RulesRng rng;
+    CompactGame game;
+    Move move;
+
+    rules_rng_seed(&rng, worker->seed);
+
+    for (uint64_t n = 0; n < worker->games; n++) {
+        rules_new_game(&game, &rng);
+        int first = game.currentTurn;
+
+        // Policy slots alternate between games so neither always starts
+        int slot_of_player0 = n & 1;
+
+        while (game.winner == RULES_NO_WINNER && game.plies < MAX_GAME_PLIES) {
+            int slot = game.currentTurn ^ slot_of_player0;
+            choose_move(&game, policies[slot], &rng, &move);
+            rules_apply(&game, &move);
+        }
+
+        stats->games++;
+        stats->totalPlies += game.plies;
+        stats->reshuffles += game.reshuffles;
+        stats->stackedSevens += game.stackedSevens;
+        stats->dryDraws += game.dryDraws;
+        if (game.reshuffles) stats->gamesWithReshuffle++;
+        if (game.stackedSevens) stats->gamesWithStackedSevens++;
+
+        stats->lengths[game.plies / LENGTH_BUCKET_WIDTH]++;
+
+        if (game.winner == RULES_NO_WINNER) {
+            stats->unfinished++;
+        } else {
+            if (game.winner == first) stats->firstPlayerWins++;
+            stats->seatWins[game.winner ^ slot_of_player0]++;
+        }
+    }
+    return NULL;
+}
+
+static void merge_stats(SimStats *total, const SimStats *part) {
+    total->games += part->games;
+    total->unfinished += part->unfinished;
+    total->firstPlayerWins += part->firstPlayerWins;
+    total->totalPlies += part->totalPlies;
+    total->gamesWithReshuffle += part->gamesWithReshuffle;
+    total->reshuffles += part->reshuffles;
+    total->gamesWithStackedSevens += part->gamesWithStackedSevens;
+    total->stackedSevens += part->stackedSevens;
+    total->dryDraws += part->dryDraws;
+    total->seatWins[0] += part->seatWins[0];
+    total->seatWins[1] += part->seatWins[1];
+    for (int i = 0; i < LENGTH_BUCKETS; i++) {
+        total->lengths[i] += part->lengths[i];
+    }
+}
+
+static uint64_t length_percentile(const SimStats *stats, double fraction) {
+    uint64_t target = (uint64_t)(stats->games * fraction);
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < LENGTH_BUCKETS - 1; i++) {
+        seen += stats->lengths[i];
+        if (seen > target) break;
+    }
+    // Upper edge of the bucket, which for the last one is the cut itself
+    uint64_t edge = (uint64_t)(i + 1) * LENGTH_BUCKET_WIDTH;
+    return edge < MAX_GAME_PLIES ? edge : MAX_GAME_PLIES;
+}
+
+static void print_report(const SimStats *stats, double seconds, int threads) {
+    double games = (double)stats->games;
+    double finished = games - stats->unfinished;
+
+    printf("Policies:            %s vs %s\n", policy_name(policies[0]), policy_name(policies[1]));
+    printf("Games:               %llu on %d threads in %.2f s (%.0f games/min)\n",
+           (unsigned long long)stats->games, threads, seconds, games / seconds * 60.0);
+    printf("Unfinished:          %llu (cut at %d plies)\n", (unsigned long long)stats->unfinished, MAX_GAME_PLIES);
+    printf("Mean length:         %.1f plies\n", stats->totalPlies / games);
+    printf("Length p50/p90/p99:  <=%llu / <=%llu / <=%llu plies\n",
+           (unsigned long long)length_percentile(stats, 0.50),
+           (unsigned long long)length_percentile(stats, 0.90),
+           (unsigned long long)length_percentile(stats, 0.99));
+    printf("First player wins:   %.2f%%\n", finished ? 100.0 * stats->firstPlayerWins / finished : 0.0);
+    printf("Slot wins:           %s %.2f%% / %s %.2f%%\n",
+           policy_name(policies[0]), finished ? 100.0 * stats->seatWins[0] / finished : 0.0,
+           policy_name(policies[1]), finished ? 100.0 * stats->seatWins[1] / finished : 0.0);
+    printf("Reshuffles:          %.2f%% of games, %.3f per game\n",
+           100.0 * stats->gamesWithReshuffle / games, stats->reshuffles / games);
+    printf("Stacked 7 penalties: %.2f%% of games, %.3f per game\n",
+           100.0 * stats->gamesWithStackedSevens / games, stats->stackedSevens / games);
+    printf("Draws from empty piles: %.3f per game\n", stats->dryDraws / games);
+
+    printf("\nLength histogram (plies: games)\n");
+    for (int i = 0; i < LENGTH_BUCKETS; i++) {
+        if (!stats->lengths[i]) continue;
+        int last = (i + 1) * LENGTH_BUCKET_WIDTH - 1;
+        printf("  %4d-%-4d %10llu  %6.2f%%\n", i * LENGTH_BUCKET_WIDTH,
+               last < MAX_GAME_PLIES ? last : MAX_GAME_PLIES,
+               (unsigned long long)stats->lengths[i], 100.0 * stats->lengths[i] / games);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n games] [-t threads] [-s seed] [-p policy[,policy]] [-r bot_rollouts]\n"
+                    "Policies: random, greedy, bot\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t games = 1000000;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = (uint64_t)time(NULL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:s:p:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            games = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'p': {
+            char *second = strchr(optarg, ',');
+            if (second) *second++ = '\0';
+            if (parse_policy(optarg, &policies[0]) < 0 ||
+                parse_policy(second ? second : optarg, &policies[1]) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case 'r':
+            bot_rollouts = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (games == 0 || bot_rollouts < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    SimWorker *workers = calloc(threads, sizeof(SimWorker));
+    if (!workers) {
+        perror("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("Simulating %llu games on %d threads (seed %llu)...\n",
+           (unsigned long long)games, threads, (unsigned long long)seed);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < threads; i++) {
+        workers[i].games = games / threads + ((uint64_t)i < games % threads ? 1 : 0);
+        workers[i].seed = seed * MAX_THREADS + i;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+
+    SimStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        merge_stats(&total, &workers[i].stats);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    print_report(&total, seconds, threads);
+    free(workers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Admin client for a server started with --admin-socket. Sends one command
+// and prints the answer as it streams in.
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-s socket] command [arg]\n"
+            "  list            running sessions\n"
+            "  players         connected players\n"
+            "  dump <slot>     full state of one session\n"
+            "  end <slot>      end a session, players return to the lobby\n"
+            "  kick <name>     disconnect a player\n"
+            "  flight <slot>   write the flight recording of a session\n"
+            "  load            event loop, bot worker and admission figures\n"
+            "  memory          bytes per connection, waiting player and session, and RSS\n",
+            name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = "/tmp/ups-admin.sock";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char command[256] = "";
+    for (int i = optind; i < argc; i++) {
+        strncat(command, argv[i], sizeof(command) - strlen(command) - 2);
+        strncat(command, i + 1 < argc ? " " : "\n", 2);
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    if (write(fd, command, strlen(command)) != (ssize_t)strlen(command)) {
+        perror("write");
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fdopen(fd, "r");
+    char line[4096];
+    while (fgets(line, sizeof(line), in)) {
+        if (strcmp(line, "END\n") == 0) return EXIT_SUCCESS;
+        if (strncmp(line, "ERR ", 4) == 0) {
+            fputs(line + 4, stderr);
+            return EXIT_FAILURE;
+        }
+        fputs(line, stdout);
+    }
+
+    fprintf(stderr, "Connection closed before the answer ended.\n");
+    return EXIT_FAILURE;
+}